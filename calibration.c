@@ -0,0 +1,330 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cars.h"
+
+#define MAX_ITERATIONS 50
+#define HUBER_ITERATIONS 5
+#define HUBER_K 1.345
+#define TUKEY_C 4.685
+
+struct _CarsCalibration {
+    size_t num_pixels;
+    unsigned degree;
+    /* polynomial in (pixel - center) / scale, lowest order first */
+    double coefficients[CARS_CALIBRATION_MAX_DEGREE + 1];
+    double center;
+    double scale;
+
+    /* per pixel, independent of the probe */
+    double *inverse_wavelength;
+    double *jacobian; /* d(1 / wavelength) / d(pixel) */
+};
+
+CarsCalibration *
+cars_calibration_new(size_t num_pixels)
+{
+    if(num_pixels == 0)
+        return NULL;
+
+    CarsCalibration *self = calloc(1, sizeof(CarsCalibration));
+    if(self == NULL)
+        return NULL;
+    self->num_pixels = num_pixels;
+    self->center = 0.5 * (num_pixels - 1);
+    self->scale = num_pixels > 1? 0.5 * (num_pixels - 1) : 1.0;
+    self->inverse_wavelength = calloc(num_pixels, sizeof(double));
+    self->jacobian = calloc(num_pixels, sizeof(double));
+    if(self->inverse_wavelength == NULL || self->jacobian == NULL) {
+        cars_calibration_free(self);
+        return NULL;
+    }
+    return self;
+}
+
+void
+cars_calibration_free(CarsCalibration *calibration)
+{
+    if(calibration == NULL)
+        return;
+    free(calibration->inverse_wavelength);
+    free(calibration->jacobian);
+    free(calibration);
+}
+
+static double
+evaluate(const CarsCalibration *cal, double pixel, double *derivative)
+{
+    double x = (pixel - cal->center) / cal->scale;
+    double value = 0.0, slope = 0.0;
+    int k;
+    for(k = cal->degree; k >= 0; k--) {
+        slope = slope * x + value;
+        value = value * x + cal->coefficients[k];
+    }
+    if(derivative)
+        *derivative = slope / cal->scale;
+    return value;
+}
+
+/* Tabulate everything that does not depend on the probe */
+static void
+tabulate(CarsCalibration *cal)
+{
+    size_t i;
+    for(i = 0; i < cal->num_pixels; i++) {
+        double slope;
+        double wavelength = evaluate(cal, (double)i, &slope);
+        cal->inverse_wavelength[i] = 1.0 / wavelength;
+        cal->jacobian[i] = -slope / (wavelength * wavelength);
+    }
+}
+
+CarsStatus
+cars_calibration_set_polynomial(CarsCalibration *calibration,
+    const double *coefficients, unsigned degree)
+{
+    if(degree > CARS_CALIBRATION_MAX_DEGREE)
+        return CARS_ERROR_INVALID;
+
+    /* Coefficients are given in raw pixels; convert them to the scaled
+    coordinate by expanding c_k (center + scale x)^k */
+    double scaled[CARS_CALIBRATION_MAX_DEGREE + 1] = { 0 };
+    double binomial[CARS_CALIBRATION_MAX_DEGREE + 1];
+    unsigned j, k;
+    for(k = 0; k <= degree; k++) {
+        /* binomial[j] = C(k, j) center^(k - j) scale^j */
+        binomial[0] = 1.0;
+        for(j = 1; j <= k; j++)
+            binomial[j] = 0.0;
+        for(j = 0; j < k; j++) {
+            unsigned m;
+            for(m = j + 1; m > 0; m--)
+                binomial[m] = binomial[m] * calibration->center +
+                    binomial[m - 1] * calibration->scale;
+            binomial[0] *= calibration->center;
+        }
+        for(j = 0; j <= k; j++)
+            scaled[j] += coefficients[k] * binomial[j];
+    }
+
+    calibration->degree = degree;
+    memcpy(calibration->coefficients, scaled, sizeof(scaled));
+    tabulate(calibration);
+    return CARS_OK;
+}
+
+CarsStatus
+cars_calibration_get_polynomial(const CarsCalibration *calibration,
+    double *coefficients, unsigned *degree)
+{
+    /* Inverse of the conversion in cars_calibration_set_polynomial() */
+    double raw[CARS_CALIBRATION_MAX_DEGREE + 1] = { 0 };
+    double power[CARS_CALIBRATION_MAX_DEGREE + 1];
+    double shift = -calibration->center / calibration->scale;
+    unsigned j, k, m;
+    for(k = 0; k <= calibration->degree; k++) {
+        /* power[j]: coefficients of ((pixel / scale) + shift)^k */
+        power[0] = 1.0;
+        for(j = 1; j <= k; j++)
+            power[j] = 0.0;
+        for(j = 0; j < k; j++) {
+            for(m = j + 1; m > 0; m--)
+                power[m] = power[m] * shift +
+                    power[m - 1] / calibration->scale;
+            power[0] *= shift;
+        }
+        for(j = 0; j <= k; j++)
+            raw[j] += calibration->coefficients[k] * power[j];
+    }
+    if(coefficients)
+        memcpy(coefficients, raw,
+            (calibration->degree + 1) * sizeof(double));
+    if(degree)
+        *degree = calibration->degree;
+    return CARS_OK;
+}
+
+/* Weighted least squares by Householder QR; a is n x m, row-major, and is
+destroyed along with b. Returns 0 if the system is rank deficient. */
+static int
+solve_least_squares(double *a, double *b, size_t n, unsigned m, double *x)
+{
+    unsigned j, k;
+    size_t i;
+
+    for(k = 0; k < m; k++) {
+        double norm = 0.0;
+        for(i = k; i < n; i++)
+            norm += a[i * m + k] * a[i * m + k];
+        norm = sqrt(norm);
+        if(norm == 0.0)
+            return 0;
+        double alpha = a[k * m + k] > 0? -norm : norm;
+        a[k * m + k] -= alpha;
+        double vnorm = 0.0;
+        for(i = k; i < n; i++)
+            vnorm += a[i * m + k] * a[i * m + k];
+        for(j = k + 1; j < m; j++) {
+            double dot = 0.0;
+            for(i = k; i < n; i++)
+                dot += a[i * m + k] * a[i * m + j];
+            dot *= 2.0 / vnorm;
+            for(i = k; i < n; i++)
+                a[i * m + j] -= dot * a[i * m + k];
+        }
+        double dot = 0.0;
+        for(i = k; i < n; i++)
+            dot += a[i * m + k] * b[i];
+        dot *= 2.0 / vnorm;
+        for(i = k; i < n; i++)
+            b[i] -= dot * a[i * m + k];
+        a[k * m + k] = alpha;
+    }
+
+    for(k = m; k-- > 0;) {
+        double sum = b[k];
+        for(j = k + 1; j < m; j++)
+            sum -= a[k * m + j] * x[j];
+        x[k] = sum / a[k * m + k];
+    }
+    return 1;
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+CarsStatus
+cars_calibration_fit(CarsCalibration *calibration, const double *pixels,
+    const double *wavelengths, size_t n, unsigned degree, double *residuals)
+{
+    unsigned m = degree + 1, k;
+    size_t i, used;
+    int iteration;
+
+    if(degree > CARS_CALIBRATION_MAX_DEGREE || n < m)
+        return CARS_ERROR_INVALID;
+
+    double *work = malloc((n * m + 4 * n) * sizeof(double));
+    if(work == NULL)
+        return CARS_ERROR_INVALID;
+    double *a = work;
+    double *b = a + n * m;
+    double *weight = b + n;
+    double *r = weight + n;
+    double *sorted = r + n;
+
+    CarsCalibration fit = *calibration;
+    double coefficients[CARS_CALIBRATION_MAX_DEGREE + 1] = { 0 };
+    fit.degree = degree;
+    for(i = 0; i < n; i++)
+        weight[i] = 1.0;
+
+    /* Iteratively reweighted least squares: a few Huber steps to get away
+    from the outliers, then Tukey's biweight to reject them completely */
+    for(iteration = 0; iteration < MAX_ITERATIONS; iteration++) {
+        double next[CARS_CALIBRATION_MAX_DEGREE + 1];
+        for(i = 0; i < n; i++) {
+            double x = (pixels[i] - fit.center) / fit.scale;
+            double sw = sqrt(weight[i]), power = 1.0;
+            for(k = 0; k < m; k++) {
+                a[i * m + k] = sw * power;
+                power *= x;
+            }
+            b[i] = sw * wavelengths[i];
+        }
+        if(!solve_least_squares(a, b, n, m, next)) {
+            if(iteration == 0) {
+                free(work);
+                return CARS_ERROR_INVALID;
+            }
+            break; /* too many points rejected; keep the previous fit */
+        }
+
+        double change = 0.0, size = 0.0;
+        for(k = 0; k < m; k++) {
+            change = fmax(change, fabs(next[k] - coefficients[k]));
+            size = fmax(size, fabs(next[k]));
+        }
+        memcpy(coefficients, next, m * sizeof(double));
+        memcpy(fit.coefficients, next, m * sizeof(double));
+        if(iteration > HUBER_ITERATIONS && change <= 1e-12 * size)
+            break;
+
+        for(i = 0; i < n; i++) {
+            r[i] = wavelengths[i] - evaluate(&fit, pixels[i], NULL);
+            sorted[i] = fabs(r[i]);
+        }
+        qsort(sorted, n, sizeof(double), compare_doubles);
+        double sigma = 1.4826 * (n % 2? sorted[n / 2] :
+            0.5 * (sorted[n / 2 - 1] + sorted[n / 2]));
+        if(sigma <= 1e-15 * size)
+            break; /* exact fit */
+
+        for(i = 0, used = 0; i < n; i++) {
+            double u = fabs(r[i]) / sigma;
+            if(iteration < HUBER_ITERATIONS)
+                weight[i] = u <= HUBER_K? 1.0 : HUBER_K / u;
+            else {
+                u /= TUKEY_C;
+                weight[i] = u < 1.0? (1.0 - u * u) * (1.0 - u * u) : 0.0;
+            }
+            if(weight[i] > 0.0)
+                used++;
+        }
+        if(used < m)
+            break;
+    }
+
+    memcpy(calibration->coefficients, coefficients, sizeof(coefficients));
+    calibration->degree = degree;
+    tabulate(calibration);
+    if(residuals)
+        for(i = 0; i < n; i++)
+            residuals[i] = wavelengths[i] -
+                evaluate(calibration, pixels[i], NULL);
+
+    free(work);
+    return CARS_OK;
+}
+
+CarsStatus
+cars_calibration_wavelengths(const CarsCalibration *calibration,
+    double *wavelengths)
+{
+    size_t i;
+    for(i = 0; i < calibration->num_pixels; i++)
+        wavelengths[i] = 1.0 / calibration->inverse_wavelength[i];
+    return CARS_OK;
+}
+
+/* The anti-Stokes Raman relation with the probe fixed, as in the free-beam
+solver: raman = 1 / antistokes - 1 / probe. Only the subtraction depends on the
+probe, so this is cheap enough to call on every change of the probe. */
+CarsStatus
+cars_calibration_raman_table(const CarsCalibration *calibration, double probe,
+    double *raman, double *jacobian)
+{
+    const double *inverse = calibration->inverse_wavelength;
+    double inverse_probe = 1.0 / probe;
+    size_t i, n = calibration->num_pixels;
+
+    if(!(probe > 0.0))
+        return CARS_ERROR_INVALID;
+    for(i = 0; i < n; i++)
+        raman[i] = inverse[i] - inverse_probe;
+    if(jacobian)
+        memcpy(jacobian, calibration->jacobian, n * sizeof(double));
+    return CARS_OK;
+}
+
+size_t
+cars_calibration_get_num_pixels(const CarsCalibration *calibration)
+{
+    return calibration->num_pixels;
+}
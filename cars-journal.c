@@ -0,0 +1,133 @@
+/* cars-journal: print the state or the changes recorded by
+cars-wavelengths --journal */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "cars.h"
+#include "journal.h"
+
+/* Options */
+static gchar *at = NULL;
+static gchar *from = NULL;
+static gchar *to = NULL;
+static gint panel = 0;
+static gchar *quantity = NULL;
+static GOptionEntry options[] = {
+    { "at", 'a', 0, G_OPTION_ARG_STRING, &at,
+        "Print the state at TIME instead of changes", "TIME" },
+    { "from", 'f', 0, G_OPTION_ARG_STRING, &from,
+        "Print changes from TIME on", "TIME" },
+    { "to", 't', 0, G_OPTION_ARG_STRING, &to,
+        "Print changes up to TIME", "TIME" },
+    { "panel", 'p', 0, G_OPTION_ARG_INT, &panel,
+        "Only print panel N", "N" },
+    { "quantity", 'q', 0, G_OPTION_ARG_STRING, &quantity,
+        "Only print the quantity shown by this widget, such as raman_shift",
+        "NAME" },
+    { NULL }
+};
+
+static const gchar *kind_names[] = {
+    "value", "lock", "mode", "degenerate", "session"
+};
+
+static void
+die(const gchar *message)
+{
+    g_printerr("cars-journal: %s\n", message);
+    exit(EXIT_FAILURE);
+}
+
+/* Seconds since the epoch, or an ISO 8601 date and time, by default in the
+local time zone */
+static gint64
+parse_time(const gchar *text)
+{
+    double seconds;
+    size_t end;
+    if(cars_parse(text, strlen(text), &seconds, &end) == CARS_OK &&
+        end == strlen(text)) {
+        /* Journal times are microseconds in a gint64 */
+        if(!isfinite(seconds) ||
+            fabs(seconds) >= (double)(G_MAXINT64 / G_TIME_SPAN_SECOND))
+            die("time in seconds is out of range");
+        return (gint64)(seconds * G_TIME_SPAN_SECOND);
+    }
+
+    GTimeZone *local = g_time_zone_new_local();
+    GDateTime *time = g_date_time_new_from_iso8601(text, local);
+    g_time_zone_unref(local);
+    if(time == NULL)
+        die("times must be seconds since the epoch or in ISO 8601 format");
+    gint64 result = g_date_time_to_unix(time) * G_TIME_SPAN_SECOND +
+        g_date_time_get_microsecond(time);
+    g_date_time_unref(time);
+    return result;
+}
+
+static gboolean
+print_record(const PJournalRecord *record, gpointer data)
+{
+    const gchar *name = p_journal_item_name(record);
+    char value[CARS_FORMAT_MAX];
+
+    if((panel > 0 && record->panel != (guint32)panel) ||
+        (quantity && strcmp(name, quantity) != 0))
+        return TRUE;
+
+    /* Round down, so that times before the epoch get a positive fraction */
+    gint64 seconds = record->time / G_TIME_SPAN_SECOND;
+    gint64 microseconds = record->time % G_TIME_SPAN_SECOND;
+    if(microseconds < 0) {
+        seconds--;
+        microseconds += G_TIME_SPAN_SECOND;
+    }
+    GDateTime *time = g_date_time_new_from_unix_local(seconds);
+    if(time == NULL)
+        die("journal time is out of range");
+    gchar *date = g_date_time_format(time, "%Y-%m-%dT%H:%M:%S");
+    cars_format(record->value, -1, value);
+    printf("%s.%06d %u %s %s %s\n", date, (int)microseconds, record->panel,
+        kind_names[P_JOURNAL_KIND(record) % P_JOURNAL_NUM_KINDS], name, value);
+    g_free(date);
+    g_date_time_unref(time);
+    return TRUE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    GOptionContext *context = g_option_context_new("FILE");
+    GError *error = NULL;
+
+    g_option_context_set_summary(context, "Print the changes recorded in a "
+        "cars-wavelengths journal, or the state at a given time. Values are "
+        "in SI units.");
+    g_option_context_add_main_entries(context, options, NULL);
+    if(!g_option_context_parse(context, &argc, &argv, &error))
+        die(error->message);
+    g_option_context_free(context);
+    if(argc != 2)
+        die("expected one journal file");
+
+    PJournalReader *reader = p_journal_reader_open(argv[1], &error);
+    if(reader == NULL)
+        die(error->message);
+
+    if(at != NULL) {
+        GArray *state = p_journal_state_at(reader, parse_time(at));
+        guint i;
+        for(i = 0; i < state->len; i++)
+            print_record(&g_array_index(state, PJournalRecord, i), NULL);
+        g_array_free(state, TRUE);
+    } else {
+        p_journal_foreach(reader, from? parse_time(from) : G_MININT64,
+            to? parse_time(to) : G_MAXINT64, print_record, NULL);
+    }
+    p_journal_reader_close(reader);
+    return EXIT_SUCCESS;
+}
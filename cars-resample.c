@@ -0,0 +1,555 @@
+/* cars-resample: resample a stream of raw spectrometer frames onto a uniform
+Raman shift grid in real time, or simulate such a stream */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cars.h"
+
+#define DEFAULT_PIXELS 2048
+#define RING_SLOTS 64
+#define RING_POLL_NS 20000
+
+/* Options */
+static size_t num_pixels = DEFAULT_PIXELS;
+static double polynomial[CARS_CALIBRATION_MAX_DEGREE + 1] = {
+    460.0, 0.03 /* nm */
+};
+static unsigned degree = 1;
+static double probe = 1064.1 / 2; /* nm */
+static double start = 500.0, step = 1.0; /* cm^-1 */
+static size_t num_bins = 2400;
+static const char *ring_path = NULL;
+static const char *output_path = NULL;
+static long simulate = -1;
+static double rate = 0.0;
+static double interval = 1.0;
+
+static double
+now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+static void
+die(const char *message)
+{
+    fprintf(stderr, "cars-resample: %s%s%s\n", message, errno? ": " : "",
+        errno? strerror(errno) : "");
+    exit(EXIT_FAILURE);
+}
+
+/* Frame sources */
+
+struct Source {
+    int fd;
+    CarsRingHeader *ring;
+    size_t ring_size;
+    uint64_t next; /* next sequence number to read from the ring */
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void
+on_signal(int signum)
+{
+    (void)signum;
+    stopping = 1;
+}
+
+static CarsRingHeader *
+map_ring(const char *path, int create, size_t *size)
+{
+    int fd = open(path, create? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+    if(fd < 0)
+        die("cannot open ring");
+    *size = sizeof(CarsRingHeader) +
+        (size_t)RING_SLOTS * num_pixels * sizeof(uint16_t);
+    if(create && ftruncate(fd, *size) < 0)
+        die("cannot size ring");
+    CarsRingHeader *ring = mmap(NULL, *size,
+        create? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if(ring == MAP_FAILED)
+        die("cannot map ring");
+    close(fd);
+    if(create) {
+        ring->num_pixels = num_pixels;
+        ring->num_slots = RING_SLOTS;
+        __atomic_store_n(&ring->magic, CARS_RING_MAGIC, __ATOMIC_RELEASE);
+    } else if(ring->magic != CARS_RING_MAGIC ||
+        ring->num_pixels != num_pixels || ring->num_slots != RING_SLOTS) {
+        errno = 0;
+        die("ring has a different layout");
+    }
+    return ring;
+}
+
+/* Read one frame; returns 0 at the end of the stream. Frames that the ring
+writer has already overwritten are added to *lapped. */
+static int
+read_frame(struct Source *source, uint16_t *frame, uint64_t *lapped)
+{
+    size_t size = num_pixels * sizeof(uint16_t);
+
+    if(source->ring == NULL) {
+        size_t done = 0;
+        while(done < size) {
+            /* SIGINT and SIGTERM interrupt the read with EINTR */
+            if(stopping)
+                return 0;
+            ssize_t count = read(source->fd, (char *)frame + done,
+                size - done);
+            if(count < 0 && errno == EINTR)
+                continue;
+            if(count <= 0)
+                return 0;
+            done += count;
+        }
+        return 1;
+    }
+
+    CarsRingHeader *ring = source->ring;
+    const uint16_t *slots = (const uint16_t *)(ring + 1);
+    struct timespec poll = { 0, RING_POLL_NS };
+    for(;;) {
+        if(stopping)
+            return 0;
+        uint64_t written = __atomic_load_n(&ring->write_count,
+            __ATOMIC_ACQUIRE);
+        if(written <= source->next) {
+            nanosleep(&poll, NULL);
+            continue;
+        }
+        /* The writer may be filling slot "written", so keep one slot clear */
+        if(written - source->next > RING_SLOTS - 1) {
+            *lapped += written - (RING_SLOTS - 1) - source->next;
+            source->next = written - (RING_SLOTS - 1);
+        }
+        memcpy(frame, slots + (source->next % RING_SLOTS) * num_pixels, size);
+        /* Keep the copy from being reordered after the check */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        written = __atomic_load_n(&ring->write_count, __ATOMIC_RELAXED);
+        if(written - source->next > RING_SLOTS - 1)
+            continue; /* overwritten while copying; counted next time */
+        source->next++;
+        return 1;
+    }
+}
+
+/* Double buffering between the reader thread and the processing loop: one
+frame is read while the other is resampled. When both buffers are taken the
+reader waits; files and pipes then hold up the writer, while the ring writer
+carries on and frames it overwrites before they are read count as dropped. */
+
+enum { BUFFER_FREE, BUFFER_FILLING, BUFFER_FULL, BUFFER_BUSY };
+
+struct Stream {
+    struct Source source;
+    uint16_t *frames[2];
+    int state[2];
+    uint64_t sequence[2];
+    int finished;
+    pthread_mutex_t lock;
+    pthread_cond_t full;
+    pthread_cond_t freed;
+
+    /* counters */
+    uint64_t received;
+    uint64_t dropped;
+    uint64_t processed;
+};
+
+static void *
+reader_thread(void *data)
+{
+    struct Stream *s = data;
+    uint64_t lapped = 0;
+
+    for(;;) {
+        int b;
+        pthread_mutex_lock(&s->lock);
+        while(s->state[0] != BUFFER_FREE && s->state[1] != BUFFER_FREE)
+            pthread_cond_wait(&s->freed, &s->lock);
+        b = s->state[0] == BUFFER_FREE? 0 : 1;
+        s->state[b] = BUFFER_FILLING;
+        pthread_mutex_unlock(&s->lock);
+
+        int ok = read_frame(&s->source, s->frames[b], &lapped);
+
+        pthread_mutex_lock(&s->lock);
+        s->dropped += lapped;
+        lapped = 0;
+        if(ok) {
+            s->state[b] = BUFFER_FULL;
+            s->sequence[b] = s->received++;
+        } else {
+            s->state[b] = BUFFER_FREE;
+            s->finished = 1;
+        }
+        pthread_cond_signal(&s->full);
+        pthread_mutex_unlock(&s->lock);
+        if(!ok)
+            return NULL;
+    }
+}
+
+/* Take the oldest full buffer, or return -1 at the end of the stream */
+static int
+take_buffer(struct Stream *s)
+{
+    int b = -1;
+    pthread_mutex_lock(&s->lock);
+    for(;;) {
+        if(s->state[0] == BUFFER_FULL && (s->state[1] != BUFFER_FULL ||
+            s->sequence[0] < s->sequence[1]))
+            b = 0;
+        else if(s->state[1] == BUFFER_FULL)
+            b = 1;
+        if(b >= 0 || s->finished)
+            break;
+        pthread_cond_wait(&s->full, &s->lock);
+    }
+    if(b >= 0)
+        s->state[b] = BUFFER_BUSY;
+    pthread_mutex_unlock(&s->lock);
+    return b;
+}
+
+static void
+release_buffer(struct Stream *s, int b)
+{
+    pthread_mutex_lock(&s->lock);
+    s->state[b] = BUFFER_FREE;
+    s->processed++;
+    pthread_cond_signal(&s->freed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void
+print_counters(struct Stream *s, double elapsed, double busy)
+{
+    pthread_mutex_lock(&s->lock);
+    uint64_t received = s->received, dropped = s->dropped,
+        processed = s->processed;
+    pthread_mutex_unlock(&s->lock);
+    fprintf(stderr, "%llu frames received, %llu processed, %llu dropped; "
+        "%.2f kHz in, %.2f kHz capacity\n", (unsigned long long)received,
+        (unsigned long long)processed, (unsigned long long)dropped,
+        elapsed > 0? 1e-3 * received / elapsed : 0.0,
+        busy > 0? 1e-3 * processed / busy : 0.0);
+}
+
+static int
+run_resampler(const char *input)
+{
+    CarsCalibration *calibration = cars_calibration_new(num_pixels);
+    double grid[2] = { start, step };
+    double coefficients[CARS_CALIBRATION_MAX_DEGREE + 1];
+    unsigned k;
+
+    /* Options are given in display units, the library works in SI */
+    for(k = 0; k <= degree; k++)
+        coefficients[k] = polynomial[k] * 1e-9;
+    cars_energy_from_unit(CARS_WAVENUMBERS, grid, grid, 2);
+    CarsResampler *resampler = cars_resampler_new(num_pixels, grid[0], grid[1],
+        num_bins);
+    double *raman = malloc(num_pixels * sizeof(double));
+    double *jacobian = malloc(num_pixels * sizeof(double));
+    double *out = malloc(num_bins * sizeof(double));
+    errno = 0;
+    if(!calibration || !resampler || !raman || !jacobian || !out)
+        die("invalid frame or grid size");
+    if(cars_calibration_set_polynomial(calibration, coefficients, degree) ||
+        cars_calibration_raman_table(calibration, probe * 1e-9, raman,
+            jacobian) ||
+        cars_resampler_set_axis(resampler, raman, jacobian))
+        die("calibration is not monotonic over the frame");
+    free(raman);
+    free(jacobian);
+
+    struct Stream s;
+    memset(&s, 0, sizeof(s));
+    s.source.fd = -1;
+    if(ring_path) {
+        s.source.ring = map_ring(ring_path, 0, &s.source.ring_size);
+        s.source.next = __atomic_load_n(&s.source.ring->write_count,
+            __ATOMIC_ACQUIRE);
+    }
+    else if(strcmp(input, "-") == 0)
+        s.source.fd = STDIN_FILENO;
+    else if((s.source.fd = open(input, O_RDONLY)) < 0)
+        die("cannot open input");
+    s.frames[0] = malloc(num_pixels * sizeof(uint16_t));
+    s.frames[1] = malloc(num_pixels * sizeof(uint16_t));
+    if(!s.frames[0] || !s.frames[1])
+        die("out of memory");
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.full, NULL);
+    pthread_cond_init(&s.freed, NULL);
+
+    FILE *output = NULL;
+    if(output_path && (output = fopen(output_path, "wb")) == NULL)
+        die("cannot open output");
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pthread_t reader;
+    if(pthread_create(&reader, NULL, reader_thread, &s) != 0)
+        die("cannot start reader");
+    /* Leave the signals to the reader, which may be blocked in read() */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    /* Nothing is allocated from here on */
+    double begin = now(), report = begin + interval, busy = 0.0;
+    int b;
+    while((b = take_buffer(&s)) >= 0) {
+        double t = now();
+        cars_resampler_process_u16(resampler, s.frames[b], out);
+        release_buffer(&s, b);
+        busy += now() - t;
+        if(output && fwrite(out, sizeof(double), num_bins, output) != num_bins)
+            die("cannot write output");
+        if(interval > 0 && t >= report) {
+            print_counters(&s, t - begin, busy);
+            report = t + interval;
+        }
+    }
+    pthread_join(reader, NULL);
+    print_counters(&s, now() - begin, busy);
+
+    if(output)
+        fclose(output);
+    if(s.source.ring)
+        munmap(s.source.ring, s.source.ring_size);
+    else if(s.source.fd != STDIN_FILENO)
+        close(s.source.fd);
+    pthread_mutex_destroy(&s.lock);
+    pthread_cond_destroy(&s.full);
+    pthread_cond_destroy(&s.freed);
+    free(s.frames[0]);
+    free(s.frames[1]);
+    free(out);
+    cars_resampler_free(resampler);
+    cars_calibration_free(calibration);
+    return EXIT_SUCCESS;
+}
+
+/* Simulator: a few Lorentzian CARS bands on a background, with shot noise,
+at fixed Raman shifts so that they stay put when the calibration changes. The
+noise of each frame is a random window into a table, to keep up with the
+resampler. */
+
+#define NOISE_SAMPLES 65536
+
+static double
+gaussian(unsigned *seed)
+{
+    double u = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static int
+run_simulator(const char *output)
+{
+    static const double bands[][3] = {
+        /* cm^-1, half width, height in counts */
+        { 1003.0, 4.0, 20000.0 },
+        { 1450.0, 12.0, 8000.0 },
+        { 2850.0, 10.0, 30000.0 },
+        { 2930.0, 15.0, 15000.0 }
+    };
+    CarsCalibration *calibration = cars_calibration_new(num_pixels);
+    double coefficients[CARS_CALIBRATION_MAX_DEGREE + 1];
+    double *raman = malloc(num_pixels * sizeof(double));
+    double *clean = malloc(num_pixels * sizeof(double));
+    uint16_t *frame = malloc(num_pixels * sizeof(uint16_t));
+    double *noise = malloc((NOISE_SAMPLES + num_pixels) * sizeof(double));
+    unsigned seed = 1, k;
+    size_t i, j;
+
+    errno = 0;
+    if(!calibration || !raman || !clean || !frame || !noise)
+        die("invalid frame size");
+    for(i = 0; i < NOISE_SAMPLES + num_pixels; i++)
+        noise[i] = gaussian(&seed);
+    for(k = 0; k <= degree; k++)
+        coefficients[k] = polynomial[k] * 1e-9;
+    cars_calibration_set_polynomial(calibration, coefficients, degree);
+    cars_calibration_raman_table(calibration, probe * 1e-9, raman, NULL);
+    cars_energy_to_unit(CARS_WAVENUMBERS, raman, raman, num_pixels);
+    for(i = 0; i < num_pixels; i++) {
+        clean[i] = 500.0;
+        for(j = 0; j < sizeof(bands) / sizeof(bands[0]); j++) {
+            double x = (raman[i] - bands[j][0]) / bands[j][1];
+            clean[i] += bands[j][2] / (1.0 + x * x);
+        }
+    }
+
+    int fd = STDOUT_FILENO;
+    CarsRingHeader *ring = NULL;
+    size_t ring_size = 0;
+    if(ring_path)
+        ring = map_ring(ring_path, 1, &ring_size);
+    else if(strcmp(output, "-") != 0 &&
+        (fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        die("cannot open output");
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    double begin = now();
+    long n;
+    for(n = 0; simulate == 0 || n < simulate; n++) {
+        uint16_t *slot = ring? (uint16_t *)(ring + 1) +
+            (n % RING_SLOTS) * num_pixels : frame;
+        const double *window = noise + rand_r(&seed) % NOISE_SAMPLES;
+        for(i = 0; i < num_pixels; i++) {
+            double counts = clean[i] + sqrt(clean[i]) * window[i];
+            slot[i] = counts < 0? 0 : counts > 65535? 65535 :
+                (uint16_t)counts;
+        }
+        if(ring) {
+            __atomic_store_n(&ring->write_count, (uint64_t)n + 1,
+                __ATOMIC_RELEASE);
+            /* Readers must see the new count before any of the next frame */
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+        }
+        else if(write(fd, frame, num_pixels * sizeof(uint16_t)) < 0)
+            die("cannot write frame");
+        if(rate > 0) {
+            next.tv_nsec += (long)(1e9 / rate);
+            while(next.tv_nsec >= 1000000000) {
+                next.tv_nsec -= 1000000000;
+                next.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+    fprintf(stderr, "%ld frames simulated, %.2f kHz\n", n,
+        1e-3 * n / (now() - begin));
+
+    if(ring)
+        munmap(ring, ring_size);
+    else if(fd != STDOUT_FILENO)
+        close(fd);
+    free(noise);
+    free(frame);
+    free(clean);
+    free(raman);
+    cars_calibration_free(calibration);
+    return EXIT_SUCCESS;
+}
+
+static void
+usage(FILE *stream)
+{
+    fprintf(stream,
+        "Usage: cars-resample [OPTION]... [FILE]\n"
+        "Resample frames of 16-bit spectrometer counts from FILE (default\n"
+        "standard input) onto a uniform Raman shift grid, as doubles.\n\n"
+        "  -n, --pixels=N          pixels per frame (%d)\n"
+        "  -c, --calibration=C0,C1,...\n"
+        "                          anti-Stokes wavelength in nm as a\n"
+        "                          polynomial in the pixel index\n"
+        "  -p, --probe=NM          probe wavelength in nm\n"
+        "      --start=CM, --step=CM, --bins=N\n"
+        "                          output grid in cm^-1\n"
+        "  -r, --ring=PATH         use a shared-memory ring instead of FILE\n"
+        "  -o, --output=PATH       write resampled frames to PATH\n"
+        "  -i, --interval=S        print the counters every S seconds\n"
+        "  -s, --simulate=N        write N simulated frames to FILE or the\n"
+        "                          ring instead (0 for no end)\n"
+        "      --rate=HZ           simulated frame rate\n",
+        DEFAULT_PIXELS);
+}
+
+static void
+parse_calibration(const char *arg)
+{
+    char *end;
+    degree = 0;
+    for(;;) {
+        polynomial[degree] = strtod(arg, &end);
+        if(end == arg)
+            break;
+        if(*end != ',')
+            return;
+        if(++degree > CARS_CALIBRATION_MAX_DEGREE)
+            break;
+        arg = end + 1;
+    }
+    usage(stderr);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    enum { OPT_START = 256, OPT_STEP, OPT_BINS, OPT_RATE };
+    static const struct option long_options[] = {
+        { "pixels", required_argument, NULL, 'n' },
+        { "calibration", required_argument, NULL, 'c' },
+        { "probe", required_argument, NULL, 'p' },
+        { "start", required_argument, NULL, OPT_START },
+        { "step", required_argument, NULL, OPT_STEP },
+        { "bins", required_argument, NULL, OPT_BINS },
+        { "ring", required_argument, NULL, 'r' },
+        { "output", required_argument, NULL, 'o' },
+        { "interval", required_argument, NULL, 'i' },
+        { "simulate", required_argument, NULL, 's' },
+        { "rate", required_argument, NULL, OPT_RATE },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option;
+
+    while((option = getopt_long(argc, argv, "n:c:p:r:o:i:s:h", long_options,
+        NULL)) != -1) {
+        switch(option) {
+            case 'n': num_pixels = strtoul(optarg, NULL, 10); break;
+            case 'c': parse_calibration(optarg); break;
+            case 'p': probe = strtod(optarg, NULL); break;
+            case OPT_START: start = strtod(optarg, NULL); break;
+            case OPT_STEP: step = strtod(optarg, NULL); break;
+            case OPT_BINS: num_bins = strtoul(optarg, NULL, 10); break;
+            case 'r': ring_path = optarg; break;
+            case 'o': output_path = optarg; break;
+            case 'i': interval = strtod(optarg, NULL); break;
+            case 's': simulate = strtol(optarg, NULL, 10); break;
+            case OPT_RATE: rate = strtod(optarg, NULL); break;
+            case 'h': usage(stdout); return EXIT_SUCCESS;
+            default: usage(stderr); return EXIT_FAILURE;
+        }
+    }
+    if(optind < argc - 1 || num_pixels < 2 || num_pixels > UINT32_MAX) {
+        usage(stderr);
+        return EXIT_FAILURE;
+    }
+    const char *file = optind < argc? argv[optind] : "-";
+
+    if(simulate >= 0)
+        return run_simulator(file);
+    return run_resampler(file);
+}
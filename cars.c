@@ -0,0 +1,544 @@
+#include <float.h>
+
+#include "cars.h"
+
+#define INVPUMP (1.0 / CARS_PUMP_WAVELENGTH)
+
+#define PUMP(v) (v)[CARS_PUMP]
+#define STOKES(v) (v)[CARS_STOKES]
+#define PROBE(v) (v)[CARS_PROBE]
+#define ANTISTOKES(v) (v)[CARS_ANTISTOKES]
+#define RAMAN(v) (v)[CARS_RAMAN]
+
+typedef void (*FreeSolver)(double *v);
+
+enum Degeneracy {
+    ANY,
+    DEGENERATE_ONLY,
+    NON_DEGENERATE_ONLY
+};
+
+struct FreeRule {
+    CarsFreeQuantity changed;
+    unsigned flags;
+    enum Degeneracy degeneracy;
+    unsigned writes;
+    FreeSolver solve;
+};
+
+struct UnitInfo {
+    double scale_factor;
+    int inverse;
+    int precision; /* decimals shown in the user interface */
+};
+
+static const struct UnitInfo beam_units[] = {
+    { 1.0e9, 0, 1 },
+    { CARS_SPEED_OF_LIGHT * 1.0e-12, 1, 1 }
+};
+static const struct UnitInfo energy_units[] = {
+    { 1.0e-2, 0, 0 },
+    { CARS_SPEED_OF_LIGHT * 1.0e-12, 0, 1 },
+    { CARS_PLANCK * CARS_SPEED_OF_LIGHT * 1.0e21, 0, 2 }
+};
+
+int
+cars_get_api_version(void)
+{
+    return CARS_API_VERSION;
+}
+
+CarsStatus
+cars_opo_solve(CarsBeamCombination mode, CarsOpoQuantity from, double *signal,
+    double *raman, double *antistokes, size_t n)
+{
+    size_t i;
+
+    if((unsigned)mode >= CARS_NUM_BEAM_COMBINATIONS)
+        return CARS_ERROR_INVALID;
+
+    switch(from) {
+        case CARS_OPO_SIGNAL:
+            for(i = 0; i < n; i++) {
+                double s = signal[i];
+                switch(mode) {
+                    case CARS_SIGNAL_IDLER:
+                        raman[i] = 2.0 / s - INVPUMP;
+                        antistokes[i] = 1.0 / (3.0 / s - INVPUMP);
+                        break;
+                    case CARS_SIGNAL_1064:
+                        raman[i] = 1.0 / s - 0.5 * INVPUMP;
+                        antistokes[i] = 1.0 / (2.0 / s - 0.5 * INVPUMP);
+                        break;
+                    default:
+                        raman[i] = 1.0 / s - 0.5 * INVPUMP;
+                        antistokes[i] = s;
+                }
+            }
+            return CARS_OK;
+        case CARS_OPO_RAMAN:
+            for(i = 0; i < n; i++) {
+                double r = raman[i], s;
+                switch(mode) {
+                    case CARS_SIGNAL_IDLER:
+                        s = 2.0 / (r + INVPUMP);
+                        antistokes[i] = 1.0 / (3.0 / s - INVPUMP);
+                        break;
+                    case CARS_SIGNAL_1064:
+                        s = 1.0 / (r + 0.5 * INVPUMP);
+                        antistokes[i] = 1.0 / (2.0 / s - 0.5 * INVPUMP);
+                        break;
+                    default:
+                        s = 1.0 / (r + 0.5 * INVPUMP);
+                        antistokes[i] = s;
+                }
+                signal[i] = s;
+            }
+            return CARS_OK;
+        case CARS_OPO_ANTISTOKES:
+            for(i = 0; i < n; i++) {
+                double a = antistokes[i], s;
+                switch(mode) {
+                    case CARS_SIGNAL_IDLER:
+                        s = 3.0 / (1.0 / a + INVPUMP);
+                        raman[i] = 2.0 / s - INVPUMP;
+                        break;
+                    case CARS_SIGNAL_1064:
+                        s = 2.0 / (1.0 / a + 0.5 * INVPUMP);
+                        raman[i] = 1.0 / s - 0.5 * INVPUMP;
+                        break;
+                    default:
+                        s = a;
+                        raman[i] = 1.0 / s - 0.5 * INVPUMP;
+                }
+                signal[i] = s;
+            }
+            return CARS_OK;
+        default:
+            return CARS_ERROR_INVALID;
+    }
+}
+
+/* Free-beam solvers, named after the quantities they write */
+
+static void
+solve_raman_antistokes(double *v)
+{
+    RAMAN(v) = 1.0 / PUMP(v) - 1.0 / STOKES(v);
+    ANTISTOKES(v) = 1.0 / (1.0 / PUMP(v) - 1.0 / STOKES(v) + 1.0 / PROBE(v));
+}
+
+static void
+solve_stokes_antistokes_from_pump(double *v)
+{
+    STOKES(v) = 1.0 / (1.0 / PUMP(v) - RAMAN(v));
+    ANTISTOKES(v) = 1.0 / (1.0 / PUMP(v) - 1.0 / STOKES(v) + 1.0 / PROBE(v));
+}
+
+static void
+solve_stokes_antistokes_from_probe(double *v)
+{
+    ANTISTOKES(v) = 1.0 / (1.0 / PROBE(v) + RAMAN(v));
+    STOKES(v) = 1.0 / (1.0 / PUMP(v) - RAMAN(v));
+}
+
+static void
+solve_raman_stokes(double *v)
+{
+    RAMAN(v) = 1.0 / ANTISTOKES(v) - 1.0 / PROBE(v);
+    STOKES(v) = 1.0 / (1.0 / PUMP(v) - RAMAN(v));
+}
+
+static void
+solve_stokes(double *v)
+{
+    STOKES(v) = 1.0 / (1.0 / PUMP(v) - RAMAN(v));
+}
+
+static void
+solve_raman_probe(double *v)
+{
+    RAMAN(v) = 1.0 / PUMP(v) - 1.0 / STOKES(v);
+    PROBE(v) = 1.0 / (1.0 / ANTISTOKES(v) - RAMAN(v));
+}
+
+static void
+solve_pump_antistokes_from_stokes(double *v)
+{
+    PUMP(v) = 1.0 / (1.0 / STOKES(v) + RAMAN(v));
+    ANTISTOKES(v) = 1.0 / (1.0 / PUMP(v) - 1.0 / STOKES(v) + 1.0 / PROBE(v));
+}
+
+static void
+solve_pump_probe_antistokes_from_stokes(double *v)
+{
+    PUMP(v) = 1.0 / (1.0 / STOKES(v) + RAMAN(v));
+    PROBE(v) = PUMP(v);
+    ANTISTOKES(v) = 1.0 / (1.0 / PUMP(v) - 1.0 / STOKES(v) + 1.0 / PROBE(v));
+}
+
+static void
+solve_pump(double *v)
+{
+    PUMP(v) = 1.0 / (1.0 / STOKES(v) + RAMAN(v));
+}
+
+static void
+solve_antistokes(double *v)
+{
+    ANTISTOKES(v) = 1.0 / (1.0 / PROBE(v) + RAMAN(v));
+}
+
+static void
+solve_raman_pump(double *v)
+{
+    RAMAN(v) = 1.0 / ANTISTOKES(v) - 1.0 / PROBE(v);
+    PUMP(v) = 1.0 / (1.0 / STOKES(v) + RAMAN(v));
+}
+
+static void
+solve_probe(double *v)
+{
+    PROBE(v) = 1.0 / (1.0 / ANTISTOKES(v) - RAMAN(v));
+}
+
+static void
+solve_pump_probe_stokes(double *v)
+{
+    PROBE(v) = 1.0 / (1.0 / ANTISTOKES(v) - RAMAN(v));
+    PUMP(v) = PROBE(v);
+    STOKES(v) = 1.0 / (1.0 / PROBE(v) - RAMAN(v));
+}
+
+static void
+solve_stokes_probe(double *v)
+{
+    STOKES(v) = 1.0 / (1.0 / PUMP(v) - RAMAN(v));
+    PROBE(v) = 1.0 / (1.0 / ANTISTOKES(v) - RAMAN(v));
+}
+
+static void
+solve_stokes_antistokes_from_raman(double *v)
+{
+    STOKES(v) = 1.0 / (1.0 / PUMP(v) - RAMAN(v));
+    ANTISTOKES(v) = 1.0 / (1.0 / PROBE(v) + RAMAN(v));
+}
+
+static void
+solve_pump_antistokes(double *v)
+{
+    PUMP(v) = 1.0 / (1.0 / STOKES(v) + RAMAN(v));
+    ANTISTOKES(v) = 1.0 / (1.0 / PROBE(v) + RAMAN(v));
+}
+
+static void
+solve_pump_probe_antistokes(double *v)
+{
+    PUMP(v) = 1.0 / (1.0 / STOKES(v) + RAMAN(v));
+    PROBE(v) = PUMP(v);
+    ANTISTOKES(v) = 1.0 / (1.0 / PROBE(v) + RAMAN(v));
+}
+
+static void
+solve_pump_probe(double *v)
+{
+    PUMP(v) = 1.0 / (1.0 / STOKES(v) + RAMAN(v));
+    PROBE(v) = 1.0 / (1.0 / ANTISTOKES(v) - RAMAN(v));
+}
+
+#define W(quantity) CARS_LOCKED(CARS_##quantity)
+
+/* For each changed quantity, the first rule whose lock requirements are met
+is the one that is applied */
+static const struct FreeRule free_rules[] = {
+    { CARS_PUMP, CARS_ANTISTOKES_UNLOCK | CARS_RAMAN_UNLOCK, ANY,
+        W(RAMAN) | W(ANTISTOKES), solve_raman_antistokes },
+    { CARS_PUMP, CARS_RAMAN_LOCK | CARS_ANTISTOKES_UNLOCK | CARS_STOKES_UNLOCK,
+        ANY, W(STOKES) | W(ANTISTOKES), solve_stokes_antistokes_from_pump },
+    { CARS_PUMP, CARS_ANTISTOKES_LOCK | CARS_RAMAN_UNLOCK | CARS_STOKES_UNLOCK,
+        ANY, W(RAMAN) | W(STOKES), solve_raman_stokes },
+    { CARS_PUMP, CARS_ANTISTOKES_LOCK | CARS_RAMAN_LOCK | CARS_STOKES_UNLOCK,
+        NON_DEGENERATE_ONLY, W(STOKES), solve_stokes },
+    { CARS_PUMP, CARS_STOKES_LOCK | CARS_ANTISTOKES_LOCK | CARS_PROBE_UNLOCK |
+        CARS_RAMAN_UNLOCK, NON_DEGENERATE_ONLY, W(RAMAN) | W(PROBE),
+        solve_raman_probe },
+
+    { CARS_STOKES, CARS_ANTISTOKES_UNLOCK | CARS_RAMAN_UNLOCK, ANY,
+        W(RAMAN) | W(ANTISTOKES), solve_raman_antistokes },
+    { CARS_STOKES, CARS_RAMAN_LOCK | CARS_ANTISTOKES_UNLOCK |
+        CARS_PUMP_UNLOCK | CARS_PROBE_UNLOCK, NON_DEGENERATE_ONLY,
+        W(PUMP) | W(ANTISTOKES), solve_pump_antistokes_from_stokes },
+    { CARS_STOKES, CARS_RAMAN_LOCK | CARS_ANTISTOKES_UNLOCK |
+        CARS_PUMP_UNLOCK | CARS_PROBE_UNLOCK, DEGENERATE_ONLY,
+        W(PUMP) | W(PROBE) | W(ANTISTOKES),
+        solve_pump_probe_antistokes_from_stokes },
+    { CARS_STOKES, CARS_ANTISTOKES_LOCK | CARS_PUMP_UNLOCK,
+        NON_DEGENERATE_ONLY, W(PUMP), solve_pump },
+    { CARS_STOKES, CARS_ANTISTOKES_LOCK | CARS_PUMP_LOCK | CARS_PROBE_UNLOCK |
+        CARS_RAMAN_UNLOCK, NON_DEGENERATE_ONLY, W(RAMAN) | W(PROBE),
+        solve_raman_probe },
+
+    { CARS_PROBE, CARS_ANTISTOKES_UNLOCK, NON_DEGENERATE_ONLY,
+        W(ANTISTOKES), solve_antistokes },
+    { CARS_PROBE, CARS_ANTISTOKES_UNLOCK | CARS_RAMAN_UNLOCK, ANY,
+        W(RAMAN) | W(ANTISTOKES), solve_raman_antistokes },
+    { CARS_PROBE, CARS_RAMAN_LOCK | CARS_ANTISTOKES_UNLOCK |
+        CARS_STOKES_UNLOCK, ANY, W(ANTISTOKES) | W(STOKES),
+        solve_stokes_antistokes_from_probe },
+    { CARS_PROBE, CARS_ANTISTOKES_LOCK | CARS_RAMAN_UNLOCK |
+        CARS_STOKES_UNLOCK, ANY, W(RAMAN) | W(STOKES), solve_raman_stokes },
+    { CARS_PROBE, CARS_STOKES_LOCK | CARS_ANTISTOKES_LOCK | CARS_PUMP_UNLOCK |
+        CARS_RAMAN_UNLOCK, NON_DEGENERATE_ONLY, W(RAMAN) | W(PUMP),
+        solve_raman_pump },
+
+    { CARS_ANTISTOKES, CARS_PROBE_UNLOCK, NON_DEGENERATE_ONLY, W(PROBE),
+        solve_probe },
+    { CARS_ANTISTOKES, CARS_PROBE_UNLOCK | CARS_STOKES_UNLOCK,
+        DEGENERATE_ONLY, W(PUMP) | W(PROBE) | W(STOKES),
+        solve_pump_probe_stokes },
+    { CARS_ANTISTOKES, CARS_PROBE_LOCK | CARS_RAMAN_UNLOCK |
+        CARS_STOKES_UNLOCK, ANY, W(RAMAN) | W(STOKES), solve_raman_stokes },
+    { CARS_ANTISTOKES, CARS_STOKES_LOCK | CARS_PROBE_LOCK | CARS_PUMP_UNLOCK |
+        CARS_RAMAN_UNLOCK, NON_DEGENERATE_ONLY, W(RAMAN) | W(PUMP),
+        solve_raman_pump },
+
+    { CARS_RAMAN, CARS_STOKES_UNLOCK | CARS_PROBE_UNLOCK, NON_DEGENERATE_ONLY,
+        W(STOKES) | W(PROBE), solve_stokes_probe },
+    { CARS_RAMAN, CARS_STOKES_UNLOCK | CARS_ANTISTOKES_UNLOCK, ANY,
+        W(STOKES) | W(ANTISTOKES), solve_stokes_antistokes_from_raman },
+    { CARS_RAMAN, CARS_STOKES_LOCK | CARS_PUMP_UNLOCK | CARS_ANTISTOKES_UNLOCK,
+        NON_DEGENERATE_ONLY, W(PUMP) | W(ANTISTOKES), solve_pump_antistokes },
+    { CARS_RAMAN, CARS_STOKES_LOCK | CARS_PUMP_UNLOCK | CARS_ANTISTOKES_UNLOCK,
+        DEGENERATE_ONLY, W(PUMP) | W(PROBE) | W(ANTISTOKES),
+        solve_pump_probe_antistokes },
+    { CARS_RAMAN, CARS_STOKES_LOCK | CARS_ANTISTOKES_LOCK | CARS_PUMP_UNLOCK |
+        CARS_PROBE_UNLOCK, NON_DEGENERATE_ONLY, W(PUMP) | W(PROBE),
+        solve_pump_probe }
+};
+#define NUM_FREE_RULES (sizeof(free_rules) / sizeof(free_rules[0]))
+
+static int
+check_locked(unsigned flags, unsigned locked)
+{
+    /* Every quantity has an UNLOCK bit followed by a LOCK bit */
+    unsigned q;
+    for(q = 0; q < CARS_NUM_FREE_QUANTITIES; q++) {
+        if(flags & (1u << (2 * q)) && locked & CARS_LOCKED(q))
+            return 0;
+        if(flags & (1u << (2 * q + 1)) && !(locked & CARS_LOCKED(q)))
+            return 0;
+    }
+    return 1;
+}
+
+static const struct FreeRule *
+find_free_rule(CarsFreeQuantity changed, unsigned locked, int degenerate)
+{
+    size_t i;
+    for(i = 0; i < NUM_FREE_RULES; i++) {
+        const struct FreeRule *rule = free_rules + i;
+        if(rule->changed != changed)
+            continue;
+        if(rule->degeneracy == DEGENERATE_ONLY && !degenerate)
+            continue;
+        if(rule->degeneracy == NON_DEGENERATE_ONLY && degenerate)
+            continue;
+        if(check_locked(rule->flags, locked))
+            return rule;
+    }
+    return NULL;
+}
+
+CarsStatus
+cars_free_solve(CarsFreeQuantity changed, unsigned locked, int degenerate,
+    double *values, size_t n, unsigned *written)
+{
+    if((unsigned)changed >= CARS_NUM_FREE_QUANTITIES)
+        return CARS_ERROR_INVALID;
+
+    const struct FreeRule *rule = find_free_rule(changed, locked, degenerate);
+    if(rule == NULL)
+        return CARS_ERROR_LOCKED;
+
+    unsigned mask = rule->writes;
+    size_t i;
+    for(i = 0; i < n; i++) {
+        double *v = values + i * CARS_NUM_FREE_QUANTITIES;
+        /* In degenerate mode the pump and probe are the same beam */
+        if(degenerate && changed == CARS_PUMP)
+            PROBE(v) = PUMP(v);
+        else if(degenerate && changed == CARS_PROBE)
+            PUMP(v) = PROBE(v);
+        rule->solve(v);
+    }
+    if(degenerate && changed == CARS_PUMP)
+        mask |= W(PROBE);
+    else if(degenerate && changed == CARS_PROBE)
+        mask |= W(PUMP);
+
+    if(written)
+        *written = mask;
+    return CARS_OK;
+}
+
+/* The smallest set of locks to release so that some rule applies. A rule
+whose LOCK requirements are met becomes applicable when the locked quantities
+that it needs unlocked are released; there are few enough rules to try them
+all. */
+CarsStatus
+cars_free_diagnose(CarsFreeQuantity changed, unsigned locked, int degenerate,
+    unsigned *conflicting, unsigned *release)
+{
+    unsigned blocking = 0, best = 0, q;
+    int best_count = CARS_NUM_FREE_QUANTITIES + 1;
+    size_t i;
+
+    if((unsigned)changed >= CARS_NUM_FREE_QUANTITIES)
+        return CARS_ERROR_INVALID;
+
+    for(i = 0; i < NUM_FREE_RULES; i++) {
+        const struct FreeRule *rule = free_rules + i;
+        unsigned need_unlocked = 0, need_locked = 0;
+        if(rule->changed != changed)
+            continue;
+        if(rule->degeneracy == DEGENERATE_ONLY && !degenerate)
+            continue;
+        if(rule->degeneracy == NON_DEGENERATE_ONLY && degenerate)
+            continue;
+        for(q = 0; q < CARS_NUM_FREE_QUANTITIES; q++) {
+            if(rule->flags & (1u << (2 * q)))
+                need_unlocked |= CARS_LOCKED(q);
+            if(rule->flags & (1u << (2 * q + 1)))
+                need_locked |= CARS_LOCKED(q);
+        }
+        if(need_locked & ~locked)
+            continue;
+
+        unsigned blocked = need_unlocked & locked;
+        /* In degenerate mode the pump and probe are locked together */
+        if(degenerate && blocked & (W(PUMP) | W(PROBE)))
+            blocked |= locked & (W(PUMP) | W(PROBE));
+        if(blocked & need_locked)
+            continue;
+        blocking |= blocked;
+
+        int count = 0;
+        for(q = 0; q < CARS_NUM_FREE_QUANTITIES; q++)
+            count += (blocked & CARS_LOCKED(q)) != 0;
+        if(count < best_count) {
+            best_count = count;
+            best = blocked;
+        }
+    }
+
+    if(conflicting)
+        *conflicting = blocking;
+    if(release)
+        *release = best;
+    return best_count > CARS_NUM_FREE_QUANTITIES? CARS_ERROR_LOCKED : CARS_OK;
+}
+
+static double
+to_unit(double value, const struct UnitInfo *unit)
+{
+    if(unit->inverse && value == 0)
+        return DBL_MAX;
+    return unit->scale_factor * (unit->inverse? (1.0 / value) : value);
+}
+
+static double
+from_unit(double value, const struct UnitInfo *unit)
+{
+    value /= unit->scale_factor;
+    return unit->inverse? 1.0 / value : value;
+}
+
+static CarsStatus
+convert(const struct UnitInfo *unit, int to, const double *in, double *out,
+    size_t n)
+{
+    size_t i;
+    if(to) {
+        for(i = 0; i < n; i++)
+            out[i] = to_unit(in[i], unit);
+    } else {
+        for(i = 0; i < n; i++)
+            out[i] = from_unit(in[i], unit);
+    }
+    return CARS_OK;
+}
+
+CarsStatus
+cars_beam_to_unit(CarsBeamUnit unit, const double *in, double *out, size_t n)
+{
+    if((unsigned)unit >= CARS_NUM_BEAM_UNITS)
+        return CARS_ERROR_INVALID;
+    return convert(beam_units + unit, 1, in, out, n);
+}
+
+CarsStatus
+cars_beam_from_unit(CarsBeamUnit unit, const double *in, double *out,
+    size_t n)
+{
+    if((unsigned)unit >= CARS_NUM_BEAM_UNITS)
+        return CARS_ERROR_INVALID;
+    return convert(beam_units + unit, 0, in, out, n);
+}
+
+CarsStatus
+cars_energy_to_unit(CarsEnergyUnit unit, const double *in, double *out,
+    size_t n)
+{
+    if((unsigned)unit >= CARS_NUM_ENERGY_UNITS)
+        return CARS_ERROR_INVALID;
+    return convert(energy_units + unit, 1, in, out, n);
+}
+
+CarsStatus
+cars_energy_from_unit(CarsEnergyUnit unit, const double *in, double *out,
+    size_t n)
+{
+    if((unsigned)unit >= CARS_NUM_ENERGY_UNITS)
+        return CARS_ERROR_INVALID;
+    return convert(energy_units + unit, 0, in, out, n);
+}
+
+static CarsStatus
+format_units(const struct UnitInfo *unit, const double *values, size_t n,
+    char separator, char *buffer, size_t size, size_t *num_values,
+    size_t *length)
+{
+    size_t i, used = 0;
+    for(i = 0; i < n && size - used >= CARS_FORMAT_MAX; i++) {
+        used += cars_format(to_unit(values[i], unit), unit->precision,
+            buffer + used);
+        buffer[used++] = separator;
+    }
+    if(num_values)
+        *num_values = i;
+    if(length)
+        *length = used;
+    return CARS_OK;
+}
+
+CarsStatus
+cars_beam_format(CarsBeamUnit unit, const double *values, size_t n,
+    char separator, char *buffer, size_t size, size_t *num_values,
+    size_t *length)
+{
+    if((unsigned)unit >= CARS_NUM_BEAM_UNITS)
+        return CARS_ERROR_INVALID;
+    return format_units(beam_units + unit, values, n, separator, buffer, size,
+        num_values, length);
+}
+
+CarsStatus
+cars_energy_format(CarsEnergyUnit unit, const double *values, size_t n,
+    char separator, char *buffer, size_t size, size_t *num_values,
+    size_t *length)
+{
+    if((unsigned)unit >= CARS_NUM_ENERGY_UNITS)
+        return CARS_ERROR_INVALID;
+    return format_units(energy_units + unit, values, n, separator, buffer,
+        size, num_values, length);
+}
@@ -0,0 +1,291 @@
+#ifndef __CARS_H__
+#define __CARS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped whenever an existing function changes incompatibly; matches the
+soname of libcars-wavelengths */
+#define CARS_API_VERSION 1
+
+#define CARS_SPEED_OF_LIGHT 2.99792458e8
+#define CARS_PLANCK 6.62606896e-34
+#define CARS_PUMP_WAVELENGTH (1064.1e-9 / 2)
+
+/* Tuning ranges of the OPO */
+#define CARS_SIGNAL_MIN 690.0e-9
+#define CARS_SIGNAL_MAX 1064.1e-9
+#define CARS_ANTISTOKES_MIN 405.1e-9
+#define CARS_ANTISTOKES_MAX 1064.1e-9
+
+/* All beams are wavelengths in meters, all Raman shifts are wavenumbers in
+inverse meters. Arrays are always owned by the caller; output arrays may be the
+same as input arrays, except where noted. */
+
+typedef enum {
+    CARS_OK = 0,
+    CARS_ERROR_INVALID = -1,
+    CARS_ERROR_LOCKED = -2
+} CarsStatus;
+
+typedef enum {
+    CARS_SIGNAL_IDLER,
+    CARS_SIGNAL_1064,
+    CARS_IDLER_1064,
+    CARS_NUM_BEAM_COMBINATIONS
+} CarsBeamCombination;
+
+typedef enum {
+    CARS_OPO_SIGNAL,
+    CARS_OPO_RAMAN,
+    CARS_OPO_ANTISTOKES,
+    CARS_NUM_OPO_QUANTITIES
+} CarsOpoQuantity;
+
+typedef enum {
+    CARS_PUMP,
+    CARS_STOKES,
+    CARS_PROBE,
+    CARS_ANTISTOKES,
+    CARS_RAMAN,
+    CARS_NUM_FREE_QUANTITIES
+} CarsFreeQuantity;
+
+typedef enum {
+    CARS_WAVELENGTHS,
+    CARS_FREQUENCIES,
+    CARS_NUM_BEAM_UNITS
+} CarsBeamUnit;
+
+typedef enum {
+    CARS_WAVENUMBERS,
+    CARS_TERAHERTZ,
+    CARS_ZEPTOJOULES,
+    CARS_NUM_ENERGY_UNITS
+} CarsEnergyUnit;
+
+/* Requirements that a branch of the free-beam solver places on the locks */
+typedef enum {
+    CARS_PUMP_UNLOCK = 1 << 0,
+    CARS_PUMP_LOCK = 1 << 1,
+    CARS_STOKES_UNLOCK = 1 << 2,
+    CARS_STOKES_LOCK = 1 << 3,
+    CARS_PROBE_UNLOCK = 1 << 4,
+    CARS_PROBE_LOCK = 1 << 5,
+    CARS_ANTISTOKES_UNLOCK = 1 << 6,
+    CARS_ANTISTOKES_LOCK = 1 << 7,
+    CARS_RAMAN_UNLOCK = 1 << 8,
+    CARS_RAMAN_LOCK = 1 << 9
+} CarsLockFlags;
+
+/* Bit for a CarsFreeQuantity in the "locked" and "written" masks */
+#define CARS_LOCKED(quantity) (1u << (quantity))
+
+int cars_get_api_version(void);
+
+/* Recompute the other two OPO quantities from the one given in "from", for n
+sets of values */
+CarsStatus cars_opo_solve(CarsBeamCombination mode, CarsOpoQuantity from,
+    double *signal, double *raman, double *antistokes, size_t n);
+
+/* Recompute the free beams after "changed" was edited. "values" holds n rows
+of CARS_NUM_FREE_QUANTITIES values, "locked" is a mask of CARS_LOCKED() bits.
+On success, the mask of quantities that were recomputed is stored in "written"
+(may be NULL). Returns CARS_ERROR_LOCKED without touching "values" if too many
+quantities are locked. */
+CarsStatus cars_free_solve(CarsFreeQuantity changed, unsigned locked,
+    int degenerate, double *values, size_t n, unsigned *written);
+
+/* Explain a CARS_ERROR_LOCKED from cars_free_solve(): "conflicting" receives
+the locked quantities that stand in the way of recomputing, and "release" the
+smallest set of them that must be unlocked (0 if nothing needs to be). Either
+may be NULL. */
+CarsStatus cars_free_diagnose(CarsFreeQuantity changed, unsigned locked,
+    int degenerate, unsigned *conflicting, unsigned *release);
+
+/* Convert between SI values and display units */
+CarsStatus cars_beam_to_unit(CarsBeamUnit unit, const double *in, double *out,
+    size_t n);
+CarsStatus cars_beam_from_unit(CarsBeamUnit unit, const double *in,
+    double *out, size_t n);
+CarsStatus cars_energy_to_unit(CarsEnergyUnit unit, const double *in,
+    double *out, size_t n);
+CarsStatus cars_energy_from_unit(CarsEnergyUnit unit, const double *in,
+    double *out, size_t n);
+
+/* Number text that does not depend on the locale. Precision -1 writes the
+shortest text that reads back as exactly the same double; for lossless
+export write SI values this way, since converting to an inverse unit such as
+THz and back may change the last bit. Otherwise, precision is the number of
+decimals (at most 17), rounded from the exact binary value, half to even, as
+printf("%.*f") does; 2.675 is written as 2.67 with two decimals. Magnitudes
+of 1e21 and more are written in the shortest form, with an exponent, whatever
+the precision. Non-finite values are written as nan, inf and -inf.
+CARS_FORMAT_MAX is enough for any value, including the terminating NUL; the
+returned length excludes it. */
+#define CARS_FORMAT_MAX 48
+
+size_t cars_format(double value, int precision, char *buffer);
+/* Format n values, each followed by "separator", into a buffer of "size"
+bytes, stopping when fewer than CARS_FORMAT_MAX bytes are left. The number of
+values written and of bytes used go into "num_values" and "length"; the text
+is not NUL-terminated. */
+CarsStatus cars_format_array(const double *values, size_t n, int precision,
+    char separator, char *buffer, size_t size, size_t *num_values,
+    size_t *length);
+/* Like cars_format_array(), but converting SI values to the unit and writing
+them with the precision of the unit's display */
+CarsStatus cars_beam_format(CarsBeamUnit unit, const double *values,
+    size_t n, char separator, char *buffer, size_t size, size_t *num_values,
+    size_t *length);
+CarsStatus cars_energy_format(CarsEnergyUnit unit, const double *values,
+    size_t n, char separator, char *buffer, size_t size, size_t *num_values,
+    size_t *length);
+
+/* Read a number from the start of text[0, length), which need not be
+NUL-terminated: an optional sign, digits with an optional decimal point and
+exponent, or inf, infinity or nan. Leading white space is not skipped. The
+number of bytes used goes into "end". Returns CARS_ERROR_INVALID if there is
+no number. */
+CarsStatus cars_parse(const char *text, size_t length, double *value,
+    size_t *end);
+/* Read up to n numbers separated by white space, commas or semicolons,
+stopping at the first text that is not a number. "num_values" receives the
+count and "end" the offset after the last number. When reading a file in
+chunks, a number at the very end of a chunk may be cut off. */
+CarsStatus cars_parse_array(const char *text, size_t length, double *values,
+    size_t n, size_t *num_values, size_t *end);
+
+/* Spectrometer calibration for multiplex CARS: maps camera pixels to
+anti-Stokes wavelengths with a polynomial, and pixels to Raman shifts for a
+given probe wavelength */
+#define CARS_CALIBRATION_MAX_DEGREE 7
+
+typedef struct _CarsCalibration CarsCalibration;
+
+CarsCalibration *cars_calibration_new(size_t num_pixels);
+void cars_calibration_free(CarsCalibration *calibration);
+size_t cars_calibration_get_num_pixels(const CarsCalibration *calibration);
+
+/* Robust polynomial fit of wavelength against pixel position to n reference
+lamp peaks; outliers such as misidentified lines are rejected. "residuals" (may
+be NULL) receives the n fit residuals. */
+CarsStatus cars_calibration_fit(CarsCalibration *calibration,
+    const double *pixels, const double *wavelengths, size_t n,
+    unsigned degree, double *residuals);
+
+/* Polynomial coefficients in raw pixel positions, lowest order first */
+CarsStatus cars_calibration_set_polynomial(CarsCalibration *calibration,
+    const double *coefficients, unsigned degree);
+CarsStatus cars_calibration_get_polynomial(const CarsCalibration *calibration,
+    double *coefficients, unsigned *degree);
+
+/* Fill num_pixels wavelengths */
+CarsStatus cars_calibration_wavelengths(const CarsCalibration *calibration,
+    double *wavelengths);
+
+/* Fill num_pixels Raman shifts for the given probe wavelength and, if
+"jacobian" is not NULL, d(Raman shift)/d(pixel) */
+CarsStatus cars_calibration_raman_table(const CarsCalibration *calibration,
+    double probe, double *raman, double *jacobian);
+
+/* Resampling of spectrometer frames onto a uniform Raman shift grid of
+num_bins bins, starting at "start" with spacing "step" (inverse meters).
+Intensities are converted from counts per pixel to counts per unit of Raman
+shift. Processing a frame does not allocate. */
+typedef struct _CarsResampler CarsResampler;
+
+CarsResampler *cars_resampler_new(size_t num_pixels, double start,
+    double step, size_t num_bins);
+void cars_resampler_free(CarsResampler *resampler);
+size_t cars_resampler_get_num_bins(const CarsResampler *resampler);
+/* Set the per-pixel Raman shifts and Jacobian, as filled in by
+cars_calibration_raman_table(); call again whenever the probe changes */
+CarsStatus cars_resampler_set_axis(CarsResampler *resampler,
+    const double *raman, const double *jacobian);
+/* Resample one frame of num_pixels values, as doubles or as raw 16-bit counts,
+into num_bins values in "out". Unlike elsewhere in this library, "frame" and
+"out" must not overlap. */
+void cars_resampler_process(const CarsResampler *resampler,
+    const double *frame, double *out);
+void cars_resampler_process_u16(const CarsResampler *resampler,
+    const uint16_t *frame, double *out);
+
+/* Sweep planning: choose a beam combination and signal wavelength for each of
+a list of Raman shifts, and an order to visit them in that minimizes the total
+tuning time. The time between two settings is given by a CarsSweepCostFunc, or
+if that is NULL, by the signal wavelength difference divided by slew_rate
+(m/s) plus mode_change_time (s) if the beam combination changes. */
+typedef double (*CarsSweepCostFunc)(CarsBeamCombination from_mode,
+    double from_signal, CarsBeamCombination to_mode, double to_signal,
+    void *data);
+
+typedef struct {
+    double slew_rate;
+    double mode_change_time;
+    CarsSweepCostFunc func;
+    void *data;
+} CarsSweepCost;
+
+/* Plan a sweep over n Raman shifts, starting from the OPO setting start_mode
+and start_signal, or from anywhere if start_mode is negative. "order" receives
+the indices of the reachable bands in visiting order, followed by those that no
+beam combination can reach; their number is stored in "num_planned" (may be
+NULL). "modes" and "signals" receive the setting of each band, or -1 and NaN if
+it is unreachable. */
+CarsStatus cars_sweep_plan(const double *raman, size_t n,
+    const CarsSweepCost *cost, int start_mode, double start_signal,
+    size_t *order, int *modes, double *signals, size_t *num_planned,
+    double *total_cost);
+
+/* OPO control settings from the vendor's tuning curves: for a signal
+wavelength, the poling period channel of the crystal, its temperature in
+degrees Celsius, and the cavity length in meters. Between the rows of the
+table the settings are interpolated linearly. */
+typedef struct _CarsTuningTable CarsTuningTable;
+
+/* Returns NULL if the table is empty, or has two rows for the same channel
+and signal wavelength */
+CarsTuningTable *cars_tuning_table_new(const double *signal,
+    const int *channel, const double *temperature, const double *cavity,
+    size_t n);
+/* Load a vendor table from a text file; see tuning.c for the format */
+CarsTuningTable *cars_tuning_table_load(const char *filename);
+void cars_tuning_table_free(CarsTuningTable *table);
+
+/* Settings for n signal wavelengths; channel -1 and NaN if no channel reaches
+the wavelength */
+CarsStatus cars_tuning_lookup(const CarsTuningTable *table,
+    const double *signal, int *channel, double *temperature, double *cavity,
+    size_t n);
+/* Signal wavelengths for n channels and temperatures, or NaN if out of range
+or if the channel's temperature curve is not monotonic */
+CarsStatus cars_tuning_inverse(const CarsTuningTable *table,
+    const int *channel, const double *temperature, double *signal, size_t n);
+
+/* Layout of a shared-memory frame ring, for example a file in /dev/shm: this
+header, followed by num_slots frames of num_pixels uint16_t samples. The
+writer fills slot (write_count % num_slots) and then increments write_count
+with a release store followed by a release fence, so that the increment is
+visible before any write to the next slot. A reader copies a slot, issues an
+acquire fence and reads write_count again to check that the slot was not
+overwritten while it was copied. */
+#define CARS_RING_MAGIC 0x53524143 /* "CARS" */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t num_pixels;
+    uint32_t num_slots;
+    uint32_t reserved;
+    uint64_t write_count;
+} CarsRingHeader;
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* __CARS_H__ */
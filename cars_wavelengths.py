@@ -0,0 +1,408 @@
+"""Python bindings for libcars-wavelengths.
+
+All functions operate in place on caller-owned buffers of C doubles, such as
+C-contiguous float64 NumPy arrays or array.array('d'); nothing is copied.
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+API_VERSION = 1
+
+SIGNAL_IDLER, SIGNAL_1064, IDLER_1064 = range(3)
+OPO_SIGNAL, OPO_RAMAN, OPO_ANTISTOKES = range(3)
+PUMP, STOKES, PROBE, ANTISTOKES, RAMAN = range(5)
+NUM_FREE_QUANTITIES = 5
+WAVELENGTHS, FREQUENCIES = range(2)
+WAVENUMBERS, TERAHERTZ, ZEPTOJOULES = range(3)
+
+_OK, _ERROR_INVALID, _ERROR_LOCKED = 0, -1, -2
+
+
+def locked(*quantities):
+    """Build a lock mask from free-beam quantity indices."""
+    mask = 0
+    for quantity in quantities:
+        mask |= 1 << quantity
+    return mask
+
+
+class LockedError(RuntimeError):
+    pass
+
+
+def _load():
+    name = os.environ.get('CARS_WAVELENGTHS_LIBRARY')
+    if name is None:
+        name = (ctypes.util.find_library('cars-wavelengths') or
+            'libcars-wavelengths.so.%d' % API_VERSION)
+    lib = ctypes.CDLL(name)
+    if lib.cars_get_api_version() != API_VERSION:
+        raise ImportError('%s has API version %d, expected %d' %
+            (name, lib.cars_get_api_version(), API_VERSION))
+    return lib
+
+_lib = _load()
+_doubles = ctypes.POINTER(ctypes.c_double)
+_lib.cars_opo_solve.argtypes = [ctypes.c_int, ctypes.c_int, _doubles,
+    _doubles, _doubles, ctypes.c_size_t]
+_lib.cars_free_solve.argtypes = [ctypes.c_int, ctypes.c_uint, ctypes.c_int,
+    _doubles, ctypes.c_size_t, ctypes.POINTER(ctypes.c_uint)]
+_lib.cars_free_diagnose.argtypes = [ctypes.c_int, ctypes.c_uint,
+    ctypes.c_int, ctypes.POINTER(ctypes.c_uint), ctypes.POINTER(ctypes.c_uint)]
+_lib.cars_calibration_new.restype = ctypes.c_void_p
+_lib.cars_calibration_new.argtypes = [ctypes.c_size_t]
+_lib.cars_calibration_free.argtypes = [ctypes.c_void_p]
+_lib.cars_calibration_fit.argtypes = [ctypes.c_void_p, _doubles, _doubles,
+    ctypes.c_size_t, ctypes.c_uint, _doubles]
+_lib.cars_calibration_set_polynomial.argtypes = [ctypes.c_void_p, _doubles,
+    ctypes.c_uint]
+_lib.cars_calibration_get_polynomial.argtypes = [ctypes.c_void_p, _doubles,
+    ctypes.POINTER(ctypes.c_uint)]
+_lib.cars_calibration_wavelengths.argtypes = [ctypes.c_void_p, _doubles]
+_lib.cars_calibration_raman_table.argtypes = [ctypes.c_void_p,
+    ctypes.c_double, _doubles, _doubles]
+_SWEEP_COST_FUNC = ctypes.CFUNCTYPE(ctypes.c_double, ctypes.c_int,
+    ctypes.c_double, ctypes.c_int, ctypes.c_double, ctypes.c_void_p)
+
+
+class _SweepCost(ctypes.Structure):
+    _fields_ = [('slew_rate', ctypes.c_double),
+        ('mode_change_time', ctypes.c_double), ('func', _SWEEP_COST_FUNC),
+        ('data', ctypes.c_void_p)]
+
+_lib.cars_sweep_plan.argtypes = [_doubles, ctypes.c_size_t,
+    ctypes.POINTER(_SweepCost), ctypes.c_int, ctypes.c_double,
+    ctypes.POINTER(ctypes.c_size_t), ctypes.POINTER(ctypes.c_int), _doubles,
+    ctypes.POINTER(ctypes.c_size_t), ctypes.POINTER(ctypes.c_double)]
+_ints = ctypes.POINTER(ctypes.c_int)
+_lib.cars_tuning_table_new.restype = ctypes.c_void_p
+_lib.cars_tuning_table_new.argtypes = [_doubles, _ints, _doubles, _doubles,
+    ctypes.c_size_t]
+_lib.cars_tuning_table_load.restype = ctypes.c_void_p
+_lib.cars_tuning_table_load.argtypes = [ctypes.c_char_p]
+_lib.cars_tuning_table_free.argtypes = [ctypes.c_void_p]
+_lib.cars_tuning_lookup.argtypes = [ctypes.c_void_p, _doubles, _ints,
+    _doubles, _doubles, ctypes.c_size_t]
+_lib.cars_tuning_inverse.argtypes = [ctypes.c_void_p, _ints, _doubles,
+    _doubles, ctypes.c_size_t]
+_lib.cars_resampler_new.restype = ctypes.c_void_p
+_lib.cars_resampler_new.argtypes = [ctypes.c_size_t, ctypes.c_double,
+    ctypes.c_double, ctypes.c_size_t]
+_lib.cars_resampler_free.argtypes = [ctypes.c_void_p]
+_lib.cars_resampler_set_axis.argtypes = [ctypes.c_void_p, _doubles, _doubles]
+_lib.cars_resampler_process.argtypes = [ctypes.c_void_p, _doubles, _doubles]
+_lib.cars_resampler_process_u16.argtypes = [ctypes.c_void_p,
+    ctypes.POINTER(ctypes.c_uint16), _doubles]
+for _name in ('cars_beam_to_unit', 'cars_beam_from_unit',
+    'cars_energy_to_unit', 'cars_energy_from_unit'):
+    getattr(_lib, _name).argtypes = [ctypes.c_int, _doubles, _doubles,
+        ctypes.c_size_t]
+_sizes = ctypes.POINTER(ctypes.c_size_t)
+_lib.cars_format_array.argtypes = [_doubles, ctypes.c_size_t, ctypes.c_int,
+    ctypes.c_char, ctypes.c_char_p, ctypes.c_size_t, _sizes, _sizes]
+_lib.cars_parse_array.argtypes = [ctypes.c_char_p, ctypes.c_size_t, _doubles,
+    ctypes.c_size_t, _sizes, _sizes]
+FORMAT_MAX = 48
+
+
+def _buffer(obj, format='d', ctype=ctypes.c_double):
+    """Wrap a writable, contiguous buffer of doubles (or of another format)
+    without copying it. Returns the ctypes array and the number of elements."""
+    view = memoryview(obj)
+    if view.format != format or not view.c_contiguous or view.readonly:
+        raise TypeError('expected a writable, C-contiguous buffer of %s' %
+            ctype.__name__[2:])
+    count = view.nbytes // ctypes.sizeof(ctype)
+    return (ctype * count).from_buffer(view), count
+
+
+def _check(status):
+    if status == _ERROR_LOCKED:
+        raise LockedError('too many parameters locked to complete that '
+            'calculation')
+    if status != _OK:
+        raise ValueError('invalid argument')
+
+
+def opo_solve(mode, source, signal, raman, antistokes):
+    """Recompute the other two OPO quantities from the one given by source
+    (OPO_SIGNAL, OPO_RAMAN or OPO_ANTISTOKES), in place."""
+    buffers = [_buffer(b) for b in (signal, raman, antistokes)]
+    count = buffers[0][1]
+    if any(n != count for _, n in buffers):
+        raise ValueError('arrays must have the same length')
+    _check(_lib.cars_opo_solve(mode, source, buffers[0][0], buffers[1][0],
+        buffers[2][0], count))
+
+
+def free_solve(changed, lock_mask, degenerate, values):
+    """Recompute the free beams in place after changed was edited. values is
+    an (n, NUM_FREE_QUANTITIES) array. Returns the mask of quantities that
+    were written; raises LockedError if too many quantities are locked."""
+    array, count = _buffer(values)
+    if count % NUM_FREE_QUANTITIES:
+        raise ValueError('values must have %d columns' % NUM_FREE_QUANTITIES)
+    written = ctypes.c_uint(0)
+    _check(_lib.cars_free_solve(changed, lock_mask, bool(degenerate), array,
+        count // NUM_FREE_QUANTITIES, ctypes.byref(written)))
+    return written.value
+
+
+def free_diagnose(changed, lock_mask, degenerate):
+    """Explain a LockedError: returns the mask of locked quantities that
+    conflict with recomputing after changed was edited, and the smallest mask
+    of them to unlock."""
+    conflicting, release = ctypes.c_uint(0), ctypes.c_uint(0)
+    _check(_lib.cars_free_diagnose(changed, lock_mask, bool(degenerate),
+        ctypes.byref(conflicting), ctypes.byref(release)))
+    return conflicting.value, release.value
+
+
+def _converter(name):
+    func = getattr(_lib, name)
+
+    def convert(unit, values, out=None):
+        array, count = _buffer(values)
+        out_array = array
+        if out is not None:
+            out_array, out_count = _buffer(out)
+            if out_count != count:
+                raise ValueError('arrays must have the same length')
+        _check(func(unit, array, out_array, count))
+        return values if out is None else out
+    convert.__name__ = name[len('cars_'):]
+    convert.__doc__ = ('Convert values with the given unit, in place unless '
+        'out is given.')
+    return convert
+
+beam_to_unit = _converter('cars_beam_to_unit')
+beam_from_unit = _converter('cars_beam_from_unit')
+energy_to_unit = _converter('cars_energy_to_unit')
+energy_from_unit = _converter('cars_energy_from_unit')
+
+
+def format_values(values, precision=-1, separator=' '):
+    """Write values as text that does not depend on the locale, each followed
+    by the separator. Precision -1 gives the shortest text that reads back as
+    exactly the same value, otherwise it is the number of decimals, rounded
+    like printf()."""
+    array, count = _buffer(values)
+    size = (count + 1) * FORMAT_MAX
+    text = ctypes.create_string_buffer(size)
+    length = ctypes.c_size_t(0)
+    _check(_lib.cars_format_array(array, count, precision,
+        separator.encode('ascii'), text, size, None, ctypes.byref(length)))
+    return text.raw[:length.value].decode('ascii')
+
+
+def parse_values(text, out):
+    """Read numbers separated by white space, commas or semicolons into out,
+    until it is full or the text holds something else. Returns the number of
+    values read."""
+    if not isinstance(text, bytes):
+        text = text.encode('ascii')
+    array, count = _buffer(out)
+    num_values = ctypes.c_size_t(0)
+    _check(_lib.cars_parse_array(text, len(text), array, count,
+        ctypes.byref(num_values), None))
+    return num_values.value
+
+
+SIGNAL_MIN, SIGNAL_MAX = 690.0e-9, 1064.1e-9
+ANTISTOKES_MIN, ANTISTOKES_MAX = 405.1e-9, 1064.1e-9
+
+
+def sweep_plan(raman, slew_rate=0.0, mode_change_time=0.0, cost=None,
+        start=None):
+    """Plan a sweep over the Raman shifts in raman. cost, if given, is called
+    as cost(from_mode, from_signal, to_mode, to_signal) and returns the time
+    to retune; otherwise the time is the signal difference divided by
+    slew_rate plus mode_change_time for a change of beam combination. start
+    is an optional (mode, signal) tuple for the current OPO setting.
+
+    Returns (order, modes, signals, num_planned, total_cost): the first
+    num_planned entries of order are the reachable bands in visiting order;
+    modes and signals are -1 and NaN for unreachable bands."""
+    array, count = _buffer(raman)
+    func = _SWEEP_COST_FUNC()
+    if cost is not None:
+        func = _SWEEP_COST_FUNC(lambda fm, fs, tm, ts, data:
+            cost(fm, fs, tm, ts))
+    sweep_cost = _SweepCost(slew_rate, mode_change_time, func, None)
+    start_mode, start_signal = start if start is not None else (-1, 0.0)
+    order = (ctypes.c_size_t * count)()
+    modes = (ctypes.c_int * count)()
+    signals = (ctypes.c_double * count)()
+    num_planned = ctypes.c_size_t(0)
+    total = ctypes.c_double(0.0)
+    _check(_lib.cars_sweep_plan(array, count, ctypes.byref(sweep_cost),
+        start_mode, start_signal, order, modes, signals,
+        ctypes.byref(num_planned), ctypes.byref(total)))
+    return (list(order), list(modes), list(signals), num_planned.value,
+        total.value)
+
+
+CALIBRATION_MAX_DEGREE = 7
+
+
+class Calibration(object):
+    """Spectrometer pixel to wavelength and Raman shift calibration."""
+
+    def __init__(self, num_pixels):
+        self.num_pixels = num_pixels
+        self._handle = _lib.cars_calibration_new(num_pixels)
+        if not self._handle:
+            raise MemoryError()
+
+    def __del__(self):
+        if getattr(self, '_handle', None):
+            _lib.cars_calibration_free(self._handle)
+            self._handle = None
+
+    def _pixel_buffer(self, buf):
+        array, count = _buffer(buf)
+        if count != self.num_pixels:
+            raise ValueError('expected %d values' % self.num_pixels)
+        return array
+
+    def fit(self, pixels, wavelengths, degree, residuals=None):
+        """Robustly fit the pixel to wavelength polynomial to reference
+        peaks; fills residuals in place if given."""
+        pixel_array, count = _buffer(pixels)
+        wavelength_array, wavelength_count = _buffer(wavelengths)
+        residual_array = None
+        if residuals is not None:
+            residual_array, residual_count = _buffer(residuals)
+            if residual_count != count:
+                raise ValueError('arrays must have the same length')
+        if wavelength_count != count:
+            raise ValueError('arrays must have the same length')
+        _check(_lib.cars_calibration_fit(self._handle, pixel_array,
+            wavelength_array, count, degree, residual_array))
+
+    @property
+    def polynomial(self):
+        coefficients = (ctypes.c_double * (CALIBRATION_MAX_DEGREE + 1))()
+        degree = ctypes.c_uint(0)
+        _check(_lib.cars_calibration_get_polynomial(self._handle,
+            coefficients, ctypes.byref(degree)))
+        return list(coefficients[:degree.value + 1])
+
+    @polynomial.setter
+    def polynomial(self, coefficients):
+        array = (ctypes.c_double * len(coefficients))(*coefficients)
+        _check(_lib.cars_calibration_set_polynomial(self._handle, array,
+            len(coefficients) - 1))
+
+    def wavelengths(self, out):
+        _check(_lib.cars_calibration_wavelengths(self._handle,
+            self._pixel_buffer(out)))
+        return out
+
+    def raman_table(self, probe, raman, jacobian=None):
+        """Fill per-pixel Raman shifts, and optionally d(shift)/d(pixel),
+        for the given probe wavelength."""
+        jacobian_array = None
+        if jacobian is not None:
+            jacobian_array = self._pixel_buffer(jacobian)
+        _check(_lib.cars_calibration_raman_table(self._handle, probe,
+            self._pixel_buffer(raman), jacobian_array))
+
+
+class Resampler(object):
+    """Resample spectrometer frames onto num_bins Raman shifts start, start +
+    step, ... in inverse meters, with intensities per unit of Raman shift."""
+
+    def __init__(self, num_pixels, start, step, num_bins):
+        self.num_pixels = num_pixels
+        self.num_bins = num_bins
+        self._handle = _lib.cars_resampler_new(num_pixels, start, step,
+            num_bins)
+        if not self._handle:
+            raise ValueError('invalid frame or grid size')
+
+    def __del__(self):
+        if getattr(self, '_handle', None):
+            _lib.cars_resampler_free(self._handle)
+            self._handle = None
+
+    def set_axis(self, raman, jacobian):
+        """Use per-pixel Raman shifts and their Jacobian, as filled in by
+        Calibration.raman_table()."""
+        arrays = [_buffer(b) for b in (raman, jacobian)]
+        if any(n != self.num_pixels for _, n in arrays):
+            raise ValueError('expected %d values' % self.num_pixels)
+        _check(_lib.cars_resampler_set_axis(self._handle, arrays[0][0],
+            arrays[1][0]))
+
+    def process(self, frame, out):
+        """Resample a frame of doubles or of 16-bit counts into out."""
+        out_array, out_count = _buffer(out)
+        if out_count != self.num_bins:
+            raise ValueError('expected %d output values' % self.num_bins)
+        if memoryview(frame).format == 'H':
+            array, count = _buffer(frame, 'H', ctypes.c_uint16)
+            func = _lib.cars_resampler_process_u16
+        else:
+            array, count = _buffer(frame)
+            func = _lib.cars_resampler_process
+        if count != self.num_pixels:
+            raise ValueError('expected %d values' % self.num_pixels)
+        func(self._handle, array, out_array)
+        return out
+
+
+class TuningTable(object):
+    """OPO control settings interpolated from a vendor tuning table: poling
+    channel, crystal temperature in degrees Celsius and cavity length in
+    meters for a signal wavelength. Channels are buffers of C ints, such as
+    array.array('i') or int32 NumPy arrays."""
+
+    def __init__(self, signal, channel, temperature, cavity):
+        arrays = [_buffer(b) for b in (signal, temperature, cavity)]
+        channel_array, count = _buffer(channel, 'i', ctypes.c_int)
+        if any(n != count for _, n in arrays):
+            raise ValueError('arrays must have the same length')
+        self._handle = _lib.cars_tuning_table_new(arrays[0][0],
+            channel_array, arrays[1][0], arrays[2][0], count)
+        if not self._handle:
+            raise ValueError('invalid tuning table')
+
+    @classmethod
+    def load(cls, filename):
+        """Load a vendor table from a text file with columns signal
+        wavelength (nm), channel, temperature (degrees C) and cavity length
+        (mm)."""
+        self = cls.__new__(cls)
+        self._handle = _lib.cars_tuning_table_load(os.fsencode(filename))
+        if not self._handle:
+            raise ValueError('cannot read tuning table %s' % filename)
+        return self
+
+    def __del__(self):
+        if getattr(self, '_handle', None):
+            _lib.cars_tuning_table_free(self._handle)
+            self._handle = None
+
+    def lookup(self, signal, channel, temperature, cavity):
+        """Fill the settings for each signal wavelength in place; channel -1
+        and NaN where no channel reaches the wavelength."""
+        signal_array, count = _buffer(signal)
+        channel_array, channel_count = _buffer(channel, 'i', ctypes.c_int)
+        arrays = [_buffer(b) for b in (temperature, cavity)]
+        if channel_count != count or any(n != count for _, n in arrays):
+            raise ValueError('arrays must have the same length')
+        _check(_lib.cars_tuning_lookup(self._handle, signal_array,
+            channel_array, arrays[0][0], arrays[1][0], count))
+
+    def inverse(self, channel, temperature, signal):
+        """Fill the signal wavelength for each channel and temperature in
+        place, or NaN if out of range."""
+        channel_array, count = _buffer(channel, 'i', ctypes.c_int)
+        arrays = [_buffer(b) for b in (temperature, signal)]
+        if any(n != count for _, n in arrays):
+            raise ValueError('arrays must have the same length')
+        _check(_lib.cars_tuning_inverse(self._handle, channel_array,
+            arrays[0][0], arrays[1][0], count))
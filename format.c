@@ -0,0 +1,748 @@
+#include <locale.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cars.h"
+#include "format-tables.h"
+
+#define MANTISSA_BITS 52
+#define EXPONENT_BITS 11
+#define EXPONENT_BIAS 1023
+#define MAX_PRECISION 17
+#define SEPARATORS " \t\r\n,;"
+
+static const char digit_pairs[200] =
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899";
+
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+    1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const uint64_t integer_powers[] = {
+    1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u, 10000000u, 100000000u,
+    1000000000u, 10000000000u, 100000000000u, 1000000000000u,
+    10000000000000u, 100000000000000u, 1000000000000000u,
+    10000000000000000u, 100000000000000000u, 1000000000000000000u,
+    10000000000000000000u
+};
+
+/* Shortest round-trip digits, after Ulf Adams' Ryu algorithm */
+
+static inline int
+pow5_bits(int e)
+{
+    return (int)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+static inline int
+log10_pow2(int e)
+{
+    return (int)(((uint32_t)e * 78913) >> 18);
+}
+
+static inline int
+log10_pow5(int e)
+{
+    return (int)(((uint32_t)e * 732923) >> 20);
+}
+
+static inline int
+multiple_of_pow5(uint64_t value, int p)
+{
+    int count = 0;
+    while(value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+    return count >= p;
+}
+
+static inline int
+multiple_of_pow2(uint64_t value, int p)
+{
+    return (value & ((UINT64_C(1) << p) - 1)) == 0;
+}
+
+/* 64 x 64 -> 128-bit product */
+static inline uint64_t
+multiply(uint64_t a, uint64_t b, uint64_t *high)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 product = (unsigned __int128)a * b;
+    *high = (uint64_t)(product >> 64);
+    return (uint64_t)product;
+#else
+    uint64_t a_low = a & 0xffffffffu, a_high = a >> 32;
+    uint64_t b_low = b & 0xffffffffu, b_high = b >> 32;
+    uint64_t ll = a_low * b_low, lh = a_low * b_high;
+    uint64_t hl = a_high * b_low, hh = a_high * b_high;
+    uint64_t middle = (ll >> 32) + (lh & 0xffffffffu) + (hl & 0xffffffffu);
+    *high = hh + (lh >> 32) + (hl >> 32) + (middle >> 32);
+    return (middle << 32) | (ll & 0xffffffffu);
+#endif
+}
+
+/* (m * mul) >> j for a 125-bit table entry "mul" and 64 < j < 128 */
+static inline uint64_t
+mul_shift(uint64_t m, const uint64_t *mul, int j)
+{
+    uint64_t high0, high1;
+    multiply(m, mul[0], &high0);
+    uint64_t low1 = multiply(m, mul[1], &high1);
+    uint64_t sum = high0 + low1;
+    high1 += sum < high0;
+    int shift = j - 64;
+    return (high1 << (64 - shift)) | (sum >> shift);
+}
+
+static inline int
+leading_zeros(uint64_t v)
+{
+#ifdef __GNUC__
+    return __builtin_clzll(v);
+#else
+    int count = 0;
+    while(!(v & (UINT64_C(1) << 63))) {
+        v <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+static inline int
+decimal_length(uint64_t v)
+{
+    int length = 1;
+    if(v >= UINT64_C(10000000000000000)) {
+        v /= UINT64_C(10000000000000000);
+        length += 16;
+    }
+    if(v >= 100000000) {
+        v /= 100000000;
+        length += 8;
+    }
+    if(v >= 10000) {
+        v /= 10000;
+        length += 4;
+    }
+    if(v >= 100) {
+        v /= 100;
+        length += 2;
+    }
+    return length + (v >= 10);
+}
+
+/* Decompose a finite, non-zero value into the shortest "digits" times
+10^"exponent" that reads back as the same double */
+static void
+shortest_digits(uint64_t bits, uint64_t *digits, int *exponent)
+{
+    uint64_t ieee_mantissa = bits & ((UINT64_C(1) << MANTISSA_BITS) - 1);
+    int ieee_exponent = (int)((bits >> MANTISSA_BITS) &
+        ((1u << EXPONENT_BITS) - 1));
+    int e2;
+    uint64_t m2;
+
+    if(ieee_exponent == 0) {
+        e2 = 1 - EXPONENT_BIAS - MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = ieee_exponent - EXPONENT_BIAS - MANTISSA_BITS - 2;
+        m2 = (UINT64_C(1) << MANTISSA_BITS) | ieee_mantissa;
+    }
+    int accept_bounds = (m2 & 1) == 0;
+
+    /* The interval of values that round to this double is [mm, mp] around
+    mv, all scaled by 4 */
+    uint64_t mv = 4 * m2;
+    unsigned mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+    uint64_t mp = 4 * m2 + 2, mm = 4 * m2 - 1 - mm_shift;
+
+    uint64_t vr, vp, vm;
+    int e10;
+    int vm_trailing_zeros = 0, vr_trailing_zeros = 0;
+    if(e2 >= 0) {
+        int q = log10_pow2(e2) - (e2 > 3);
+        int k = POW5_INV_BITCOUNT + pow5_bits(q) - 1;
+        int i = -e2 + q + k;
+        e10 = q;
+        vr = mul_shift(mv, pow5_inv_split[q], i);
+        vp = mul_shift(mp, pow5_inv_split[q], i);
+        vm = mul_shift(mm, pow5_inv_split[q], i);
+        if(q <= 21) {
+            /* Only the smallest exponents can make the bounds exact */
+            if(mv % 5 == 0)
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            else if(accept_bounds)
+                vm_trailing_zeros = multiple_of_pow5(mm, q);
+            else
+                vp -= multiple_of_pow5(mp, q);
+        }
+    } else {
+        int q = log10_pow5(-e2) - (-e2 > 1);
+        int i = -e2 - q;
+        int k = pow5_bits(i) - POW5_BITCOUNT;
+        int j = q - k;
+        e10 = q + e2;
+        vr = mul_shift(mv, pow5_split[i], j);
+        vp = mul_shift(mp, pow5_split[i], j);
+        vm = mul_shift(mm, pow5_split[i], j);
+        if(q <= 1) {
+            vr_trailing_zeros = 1;
+            if(accept_bounds)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                vp--;
+        } else if(q < 63) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    /* Remove digits while the bounds still differ */
+    int removed = 0;
+    unsigned last_removed = 0;
+    uint64_t output;
+    if(vm_trailing_zeros || vr_trailing_zeros) {
+        while(vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = (unsigned)(vr % 10);
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if(vm_trailing_zeros) {
+            while(vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = (unsigned)(vr % 10);
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        /* Round half to even on an exact tie */
+        if(vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+            last_removed = 4;
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) ||
+            last_removed >= 5);
+    } else {
+        int round_up = 0;
+        /* Usually at least two digits go, so start by removing a pair */
+        if(vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while(vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || round_up);
+    }
+    *digits = output;
+    *exponent = e10 + removed;
+}
+
+/* Write the "length" decimal digits of "value" at "out", working in 32 bits
+where possible since 64-bit division is slow */
+static inline void
+write_digits(char *out, uint64_t value, int length)
+{
+    char *p = out + length;
+    uint32_t low;
+    int k;
+    if(value >> 32) {
+        uint64_t high = value / 100000000;
+        low = (uint32_t)(value - 100000000 * high);
+        value = high;
+        for(k = 0; k < 4; k++) {
+            uint32_t pair = (low % 100) * 2;
+            low /= 100;
+            *--p = digit_pairs[pair + 1];
+            *--p = digit_pairs[pair];
+        }
+    }
+    low = (uint32_t)value;
+    while(low >= 100) {
+        uint32_t pair = (low % 100) * 2;
+        low /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if(low >= 10) {
+        *--p = digit_pairs[low * 2 + 1];
+        *--p = digit_pairs[low * 2];
+    } else {
+        *--p = (char)('0' + low);
+    }
+}
+
+static size_t
+format_special(double value, char *buffer)
+{
+    const char *text = isnan(value)? "nan" : value < 0? "-inf" : "inf";
+    strcpy(buffer, text);
+    return strlen(text);
+}
+
+static size_t
+format_shortest(double value, char *buffer)
+{
+    uint64_t bits, digits;
+    int exponent;
+    char *p = buffer;
+
+    memcpy(&bits, &value, sizeof(bits));
+    if(bits >> 63)
+        *p++ = '-';
+    if((bits & ~(UINT64_C(1) << 63)) == 0) {
+        *p++ = '0';
+        *p = '\0';
+        return p - buffer;
+    }
+    shortest_digits(bits, &digits, &exponent);
+    int length = decimal_length(digits);
+    int point = exponent + length; /* digits before the decimal point */
+
+    if(point > -6 && point <= 21) {
+        if(exponent >= 0) {
+            write_digits(p, digits, length);
+            memset(p + length, '0', exponent);
+            p += point;
+        } else if(point > 0) {
+            write_digits(p + 1, digits, length);
+            memmove(p, p + 1, point);
+            p[point] = '.';
+            p += length + 1;
+        } else {
+            p[0] = '0';
+            p[1] = '.';
+            memset(p + 2, '0', -point);
+            write_digits(p + 2 - point, digits, length);
+            p += 2 - point + length;
+        }
+    } else {
+        int scientific = point - 1;
+        write_digits(p + 1, digits, length);
+        p[0] = p[1];
+        if(length > 1) {
+            p[1] = '.';
+            p += length + 1;
+        } else {
+            p++;
+        }
+        *p++ = 'e';
+        *p++ = scientific < 0? '-' : '+';
+        scientific = abs(scientific);
+        if(scientific >= 100) {
+            *p++ = (char)('0' + scientific / 100);
+            scientific %= 100;
+            *p++ = digit_pairs[scientific * 2];
+            *p++ = digit_pairs[scientific * 2 + 1];
+        } else if(scientific >= 10) {
+            *p++ = digit_pairs[scientific * 2];
+            *p++ = digit_pairs[scientific * 2 + 1];
+        } else {
+            *p++ = (char)('0' + scientific);
+        }
+    }
+    *p = '\0';
+    return p - buffer;
+}
+
+/* Fixed decimals. The value is m 2^e, so the digits to write are the integer
+m 5^p 2^(e + p) for p decimals, rounded half to even like printf() rounds the
+binary value. Below 1e21 with at most 17 decimals that integer has at most 127
+bits; it is kept in 32-bit limbs, least significant first. */
+
+#define LIMBS 5
+#define POW5_13 UINT32_C(1220703125)
+
+static int
+limbs_multiply(uint32_t *limbs, int n, uint32_t factor)
+{
+    uint64_t carry = 0;
+    int i;
+    for(i = 0; i < n; i++) {
+        carry += (uint64_t)limbs[i] * factor;
+        limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    if(carry)
+        limbs[n++] = (uint32_t)carry;
+    return n;
+}
+
+/* Divide by 10^9 in place and return the remainder */
+static uint32_t
+limbs_divide(uint32_t *limbs, int *n)
+{
+    uint64_t rest = 0;
+    int i;
+    for(i = *n - 1; i >= 0; i--) {
+        rest = rest << 32 | limbs[i];
+        limbs[i] = (uint32_t)(rest / 1000000000);
+        rest %= 1000000000;
+    }
+    while(*n > 0 && limbs[*n - 1] == 0)
+        (*n)--;
+    return (uint32_t)rest;
+}
+
+/* Write the rounded digits of m 5^p 2^shift to "text", without leading
+zeros, and return how many there are */
+static int
+fixed_digits(uint64_t m, int p, int shift, char *text)
+{
+    uint32_t limbs[LIMBS] = { (uint32_t)m, (uint32_t)(m >> 32) };
+    int n = limbs[1]? 2 : 1, i;
+
+    for(; p >= 13; p -= 13)
+        n = limbs_multiply(limbs, n, POW5_13);
+    n = limbs_multiply(limbs, n, (uint32_t)(integer_powers[p] >> p));
+
+    if(shift < -32 * n) {
+        n = 0; /* less than a half */
+    } else if(shift < 0) {
+        int bits = -shift, words = bits / 32, rest = bits % 32;
+        uint32_t half_bit = (bits - 1) % 32, half_word = (bits - 1) / 32;
+        int half = (limbs[half_word] >> half_bit) & 1;
+        int sticky = (limbs[half_word] & ((UINT32_C(1) << half_bit) - 1)) != 0;
+        for(i = 0; i < (int)half_word; i++)
+            sticky |= limbs[i] != 0;
+        for(i = 0; i + words < n; i++) {
+            uint64_t pair = limbs[i + words] |
+                (i + words + 1 < n? (uint64_t)limbs[i + words + 1] << 32 : 0);
+            limbs[i] = (uint32_t)(pair >> rest);
+        }
+        n -= words;
+        if(half && (sticky || (n > 0 && limbs[0] & 1))) {
+            for(i = 0; i < n && ++limbs[i] == 0; i++)
+                ;
+            if(i == n)
+                limbs[n++] = 1;
+        }
+    } else if(shift > 0) {
+        int words = shift / 32, rest = shift % 32;
+        for(i = n + words; i >= words; i--) {
+            uint64_t pair = (i - words < n? (uint64_t)limbs[i - words] << 32 :
+                0) | (i - words - 1 >= 0 && i - words - 1 < n?
+                limbs[i - words - 1] : 0);
+            limbs[i] = (uint32_t)(pair >> (32 - rest));
+        }
+        for(i = 0; i < words; i++)
+            limbs[i] = 0;
+        n += words + 1;
+    }
+    while(n > 0 && limbs[n - 1] == 0)
+        n--;
+
+    /* Nine digits at a time, from the end */
+    char reversed[LIMBS * 10];
+    int length = 0;
+    do {
+        uint32_t group = limbs_divide(limbs, &n);
+        for(i = 0; i < 9 && (n > 0 || group > 0 || length == 0); i++) {
+            reversed[length++] = (char)('0' + group % 10);
+            group /= 10;
+        }
+    } while(n > 0);
+    for(i = 0; i < length; i++)
+        text[i] = reversed[length - 1 - i];
+    return length;
+}
+
+static size_t
+format_fixed(double value, int precision, char *buffer)
+{
+    uint64_t bits, m;
+    char *p = buffer;
+
+    if(fabs(value) >= 1e21)
+        return format_shortest(value, buffer);
+    memcpy(&bits, &value, sizeof(bits));
+    if(bits >> 63)
+        *p++ = '-';
+    m = bits & ((UINT64_C(1) << MANTISSA_BITS) - 1);
+    int ieee_exponent = (int)((bits >> MANTISSA_BITS) &
+        ((1u << EXPONENT_BITS) - 1));
+    int e = (ieee_exponent? ieee_exponent : 1) - EXPONENT_BIAS - MANTISSA_BITS;
+    if(ieee_exponent)
+        m |= UINT64_C(1) << MANTISSA_BITS;
+
+    char text[CARS_FORMAT_MAX];
+    int total = fixed_digits(m, precision, e + precision, text);
+    if(total == 1 && text[0] == '0')
+        total = 0;
+    if(total > precision) {
+        int point = total - precision;
+        memcpy(p, text, point);
+        p += point;
+        if(precision > 0) {
+            *p++ = '.';
+            memcpy(p, text + point, precision);
+            p += precision;
+        }
+    } else {
+        *p++ = '0';
+        if(precision > 0) {
+            *p++ = '.';
+            memset(p, '0', precision - total);
+            memcpy(p + precision - total, text, total);
+            p += precision;
+        }
+    }
+    *p = '\0';
+    return p - buffer;
+}
+
+size_t
+cars_format(double value, int precision, char *buffer)
+{
+    if(!isfinite(value))
+        return format_special(value, buffer);
+    if(precision < 0)
+        return format_shortest(value, buffer);
+    return format_fixed(value, precision > MAX_PRECISION? MAX_PRECISION :
+        precision, buffer);
+}
+
+CarsStatus
+cars_format_array(const double *values, size_t n, int precision,
+    char separator, char *buffer, size_t size, size_t *num_values,
+    size_t *length)
+{
+    size_t i, used = 0;
+    for(i = 0; i < n && size - used >= CARS_FORMAT_MAX; i++) {
+        used += cars_format(values[i], precision, buffer + used);
+        buffer[used++] = separator;
+    }
+    if(num_values)
+        *num_values = i;
+    if(length)
+        *length = used;
+    return CARS_OK;
+}
+
+/* w times 10^q, correctly rounded, using the same 125-bit powers of five as
+the formatting. The table entries are truncated, which puts the product
+within w of the true value; if that is too close to a rounding boundary, or
+the result is not a normal double, returns 0 and leaves it to strtod(). */
+static int
+parse_scaled(uint64_t w, long q, double *result)
+{
+    const uint64_t *power;
+    int e, exact = q >= 0 && q <= 53;
+
+    if(q <= -POW5_INV_TABLE_SIZE || q >= POW5_TABLE_SIZE)
+        return 0;
+    if(q >= 0) {
+        power = pow5_split[q];
+        e = pow5_bits(q) - POW5_BITCOUNT + q;
+    } else {
+        power = pow5_inv_split[-q];
+        e = q - pow5_bits(-q) + 1 - POW5_INV_BITCOUNT;
+    }
+    int z = leading_zeros(w);
+    w <<= z;
+    e -= z;
+
+    uint64_t carry, p1, p2;
+    uint64_t p0 = multiply(w, power[0], &carry);
+    uint64_t low = multiply(w, power[1], &p2);
+    p1 = low + carry;
+    p2 += p1 < low;
+
+    /* The top 54 bits are the mantissa and the rounding bit */
+    int shift = 10 - leading_zeros(p2);
+    uint64_t window = p2 >> shift, mask = (UINT64_C(1) << shift) - 1;
+    uint64_t rest = p2 & mask;
+    int round_up;
+    if(exact) {
+        round_up = (window & 1) && (rest || p1 || p0 || (window & 2));
+    } else {
+        if((rest == 0 && p1 < 2) || (rest == mask && p1 > UINT64_MAX - 3))
+            return 0;
+        round_up = window & 1;
+    }
+    uint64_t mantissa = (window >> 1) + round_up;
+    int exponent = 128 + shift + 1 + e;
+    if(mantissa >> 53) {
+        mantissa >>= 1;
+        exponent++;
+    }
+    int biased = exponent + MANTISSA_BITS + EXPONENT_BIAS;
+    if(biased < 1 || biased > 2046)
+        return 0;
+    uint64_t bits = ((uint64_t)biased << MANTISSA_BITS) |
+        (mantissa & ((UINT64_C(1) << MANTISSA_BITS) - 1));
+    memcpy(result, &bits, sizeof(bits));
+    return 1;
+}
+
+/* Hand numbers that the fast path cannot convert exactly to strtod(), with
+the decimal point of the current locale */
+static double
+parse_slow(const char *start, size_t length)
+{
+    const char *point = localeconv()->decimal_point;
+    size_t point_length = strlen(point), i, used = 0;
+    char local[64], *copy = local;
+    double value;
+
+    if(length * point_length + 1 > sizeof(local)) {
+        copy = malloc(length * point_length + 1);
+        if(copy == NULL)
+            return NAN;
+    }
+    for(i = 0; i < length; i++) {
+        if(start[i] == '.') {
+            memcpy(copy + used, point, point_length);
+            used += point_length;
+        } else {
+            copy[used++] = start[i];
+        }
+    }
+    copy[used] = '\0';
+    value = strtod(copy, NULL);
+    if(copy != local)
+        free(copy);
+    return value;
+}
+
+static int
+match_word(const char *p, const char *stop, const char *word)
+{
+    size_t i, length = strlen(word);
+    if((size_t)(stop - p) < length)
+        return 0;
+    for(i = 0; i < length; i++)
+        if((p[i] | 0x20) != word[i])
+            return 0;
+    return 1;
+}
+
+CarsStatus
+cars_parse(const char *text, size_t length, double *value, size_t *end)
+{
+    const char *p = text, *stop = text + length, *start;
+    int negative = 0, any = 0, significant = 0, truncated = 0;
+    long exponent = 0;
+    uint64_t mantissa = 0;
+
+    if(p < stop && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    start = p;
+
+    if(match_word(p, stop, "inf") || match_word(p, stop, "nan")) {
+        double special = (p[0] | 0x20) == 'n'? NAN : INFINITY;
+        p += match_word(p, stop, "infinity")? 8 : 3;
+        *value = negative? -special : special;
+        if(end)
+            *end = p - text;
+        return CARS_OK;
+    }
+
+    for(; p < stop && *p >= '0' && *p <= '9'; p++) {
+        unsigned digit = *p - '0';
+        any = 1;
+        if(significant == 0 && digit == 0)
+            continue;
+        if(significant < 19) {
+            mantissa = 10 * mantissa + digit;
+            significant++;
+        } else {
+            exponent++;
+            truncated |= digit != 0;
+        }
+    }
+    if(p < stop && *p == '.') {
+        for(p++; p < stop && *p >= '0' && *p <= '9'; p++) {
+            unsigned digit = *p - '0';
+            any = 1;
+            if(significant == 0 && digit == 0) {
+                exponent--;
+            } else if(significant < 19) {
+                mantissa = 10 * mantissa + digit;
+                significant++;
+                exponent--;
+            } else {
+                truncated |= digit != 0;
+            }
+        }
+    }
+    if(!any)
+        return CARS_ERROR_INVALID;
+
+    if(p < stop && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int exponent_negative = 0;
+        long written = 0;
+        if(q < stop && (*q == '-' || *q == '+'))
+            exponent_negative = *q++ == '-';
+        if(q < stop && *q >= '0' && *q <= '9') {
+            for(; q < stop && *q >= '0' && *q <= '9'; q++)
+                if(written < 100000)
+                    written = 10 * written + (*q - '0');
+            exponent += exponent_negative? -written : written;
+            p = q;
+        }
+    }
+
+    double result;
+    if(mantissa == 0) {
+        result = 0.0;
+    } else if(!truncated && mantissa <= (UINT64_C(1) << 53) &&
+        exponent >= -22 && exponent <= 22) {
+        /* Both operands are exact, so one rounding gives the correct
+        result */
+        result = (double)mantissa;
+        result = exponent < 0? result / exact_powers[-exponent] :
+            result * exact_powers[exponent];
+    } else if(!truncated && exponent > 22 && exponent <= 22 + 15 &&
+        mantissa <= (UINT64_C(1) << 53) / integer_powers[exponent - 22]) {
+        result = (double)(mantissa * integer_powers[exponent - 22]) * 1e22;
+    } else if(truncated || !parse_scaled(mantissa, exponent, &result)) {
+        result = parse_slow(start, p - start);
+    }
+    *value = negative? -result : result;
+    if(end)
+        *end = p - text;
+    return CARS_OK;
+}
+
+CarsStatus
+cars_parse_array(const char *text, size_t length, double *values, size_t n,
+    size_t *num_values, size_t *end)
+{
+    size_t i, used = 0;
+    for(i = 0; i < n; i++) {
+        size_t consumed;
+        while(used < length && strchr(SEPARATORS, text[used]) &&
+            text[used] != '\0')
+            used++;
+        if(used == length ||
+            cars_parse(text + used, length - used, values + i, &consumed) !=
+            CARS_OK)
+            break;
+        used += consumed;
+    }
+    if(num_values)
+        *num_values = i;
+    if(end)
+        *end = used;
+    return CARS_OK;
+}
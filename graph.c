@@ -0,0 +1,194 @@
+#include <string.h>
+#include <glib.h>
+
+#include "graph.h"
+
+struct Relation {
+    PGraphTrigger trigger;
+    guint64 inputs;
+    guint64 outputs;
+    PGraphFunc func;
+    gpointer data;
+};
+
+struct _PGraph {
+    guint num_nodes;
+    gdouble *values;
+    gdouble *scratch;
+    GArray *relations;
+    guint *order; /* relation indices in topological order */
+    gboolean order_valid;
+    PGraphNotify notify;
+    gpointer notify_data;
+};
+
+PGraph *
+p_graph_new(guint num_nodes, PGraphNotify notify, gpointer data)
+{
+    g_return_val_if_fail(num_nodes <= P_GRAPH_MAX_NODES, NULL);
+
+    PGraph *self = g_slice_new0(PGraph);
+    self->num_nodes = num_nodes;
+    self->values = g_new0(gdouble, num_nodes);
+    self->scratch = g_new0(gdouble, num_nodes);
+    self->relations = g_array_new(FALSE, FALSE, sizeof(struct Relation));
+    self->notify = notify;
+    self->notify_data = data;
+    return self;
+}
+
+void
+p_graph_free(PGraph *graph)
+{
+    g_free(graph->values);
+    g_free(graph->scratch);
+    g_free(graph->order);
+    g_array_free(graph->relations, TRUE);
+    g_slice_free(PGraph, graph);
+}
+
+void
+p_graph_add_relation(PGraph *graph, PGraphTrigger trigger, guint64 inputs,
+    guint64 outputs, PGraphFunc func, gpointer data)
+{
+    struct Relation relation = { trigger, inputs, outputs, func, data };
+    g_array_append_val(graph->relations, relation);
+    graph->order_valid = FALSE;
+}
+
+/* Relation A comes before relation B if A writes something that B reads.
+Relations that depend on each other in a cycle, such as a link in both
+directions between two nodes, are ordered after everything they depend on and
+otherwise keep the order they were added in; a pass never writes a node twice,
+which breaks the cycle. */
+static void
+sort_relations(PGraph *graph)
+{
+    guint n = graph->relations->len, i, j, k;
+    struct Relation *r = (struct Relation *)graph->relations->data;
+    gboolean *reach = g_new0(gboolean, n * n);
+    guint *indegree = g_new0(guint, n);
+    gboolean *done = g_new0(gboolean, n);
+
+    /* Transitive closure of the dependencies, to find the cycles */
+    for(i = 0; i < n; i++)
+        for(j = 0; j < n; j++)
+            reach[i * n + j] = i != j && (r[i].outputs & r[j].inputs) != 0;
+    for(k = 0; k < n; k++)
+        for(i = 0; i < n; i++)
+            for(j = 0; j < n; j++)
+                if(reach[i * n + k] && reach[k * n + j])
+                    reach[i * n + j] = TRUE;
+
+#define CROSS_EDGE(a, b) ((a) != (b) && r[a].outputs & r[b].inputs && \
+    !(reach[(a) * n + (b)] && reach[(b) * n + (a)]))
+
+    for(i = 0; i < n; i++)
+        for(j = 0; j < n; j++)
+            if(CROSS_EDGE(i, j))
+                indegree[j]++;
+
+    /* Kahn's algorithm on the acyclic graph of cycles */
+    g_free(graph->order);
+    graph->order = g_new(guint, n);
+    for(k = 0; k < n; k++) {
+        guint next = 0;
+        while(done[next] || indegree[next] > 0)
+            next++;
+        done[next] = TRUE;
+        graph->order[k] = next;
+        for(j = 0; j < n; j++)
+            if(CROSS_EDGE(next, j))
+                indegree[j]--;
+    }
+
+#undef CROSS_EDGE
+    g_free(reach);
+    g_free(indegree);
+    g_free(done);
+    graph->order_valid = TRUE;
+}
+
+static gboolean
+run_pass(PGraph *graph, guint edited)
+{
+    guint64 dirty = P_GRAPH_NODE(edited);
+    guint64 settled = dirty;
+    gboolean ok = TRUE;
+    guint i, node;
+
+    if(!graph->order_valid)
+        sort_relations(graph);
+
+    for(i = 0; i < graph->relations->len; i++) {
+        struct Relation *r = &g_array_index(graph->relations, struct Relation,
+            graph->order[i]);
+        gboolean triggered = r->trigger == P_GRAPH_ON_EDIT?
+            (r->inputs & P_GRAPH_NODE(edited)) != 0 : (r->inputs & dirty) != 0;
+        if(!triggered)
+            continue;
+
+        memcpy(graph->scratch, graph->values,
+            graph->num_nodes * sizeof(gdouble));
+        guint64 written = r->outputs;
+        if(!r->func(edited, graph->scratch, &written, r->data)) {
+            ok = FALSE;
+            continue;
+        }
+
+        for(node = 0; node < graph->num_nodes; node++) {
+            guint64 bit = P_GRAPH_NODE(node);
+            if(!(written & bit) || settled & bit)
+                continue;
+            settled |= bit;
+            if(graph->scratch[node] != graph->values[node]) {
+                graph->values[node] = graph->scratch[node];
+                dirty |= bit;
+            }
+        }
+    }
+
+    if(graph->notify) {
+        for(node = 0; node < graph->num_nodes; node++) {
+            if(node == edited || !(dirty & P_GRAPH_NODE(node)))
+                continue;
+            graph->notify(node, graph->values[node], graph->notify_data);
+        }
+    }
+    return ok;
+}
+
+/* Set a node's value without running a pass */
+void
+p_graph_init_value(PGraph *graph, guint node, gdouble value)
+{
+    g_return_if_fail(node < graph->num_nodes);
+    graph->values[node] = value;
+}
+
+gdouble
+p_graph_get_value(PGraph *graph, guint node)
+{
+    g_return_val_if_fail(node < graph->num_nodes, 0.0);
+    return graph->values[node];
+}
+
+/* Edit a node and recompute everything that depends on it. Returns FALSE if
+any triggered relation could not be applied. */
+gboolean
+p_graph_set_value(PGraph *graph, guint node, gdouble value)
+{
+    g_return_val_if_fail(node < graph->num_nodes, FALSE);
+    graph->values[node] = value;
+    return run_pass(graph, node);
+}
+
+/* Treat a node as edited without changing its value, for example when a
+parameter of the relations changed */
+gboolean
+p_graph_touch(PGraph *graph, guint node)
+{
+    g_return_val_if_fail(node < graph->num_nodes, FALSE);
+    return run_pass(graph, node);
+}
+
@@ -0,0 +1,43 @@
+#ifndef __P_GRAPH_H__
+#define __P_GRAPH_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A small dataflow engine. Nodes hold values; relations compute some nodes
+from others. Editing a node runs one pass over the relations in topological
+order, recomputing only what depends on a changed node, and every node whose
+value actually changed is reported once through the notify function. */
+
+typedef struct _PGraph PGraph;
+
+typedef enum {
+    /* Runs when one of its input nodes is edited directly */
+    P_GRAPH_ON_EDIT,
+    /* Runs when one of its input nodes changes during a pass */
+    P_GRAPH_ON_CHANGE
+} PGraphTrigger;
+
+/* Computes a relation in place on a copy of the node values. "written" starts
+out as the relation's outputs and may be narrowed. Returns FALSE if the relation
+cannot be applied, in which case nothing it computed is kept. */
+typedef gboolean (*PGraphFunc)(guint edited, gdouble *values, guint64 *written,
+    gpointer data);
+typedef void (*PGraphNotify)(guint node, gdouble value, gpointer data);
+
+#define P_GRAPH_NODE(node) (G_GUINT64_CONSTANT(1) << (node))
+#define P_GRAPH_MAX_NODES 64
+
+PGraph *p_graph_new(guint num_nodes, PGraphNotify notify, gpointer data);
+void p_graph_free(PGraph *graph);
+void p_graph_add_relation(PGraph *graph, PGraphTrigger trigger, guint64 inputs,
+    guint64 outputs, PGraphFunc func, gpointer data);
+void p_graph_init_value(PGraph *graph, guint node, gdouble value);
+gdouble p_graph_get_value(PGraph *graph, guint node);
+gboolean p_graph_set_value(PGraph *graph, guint node, gdouble value);
+gboolean p_graph_touch(PGraph *graph, guint node);
+
+G_END_DECLS
+
+#endif // __P_GRAPH_H__
@@ -0,0 +1,509 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "cars.h"
+#include "journal.h"
+
+#define MAGIC "CARSJRNL"
+#define VERSION 1
+#define FLUSH_INTERVAL G_TIME_SPAN_SECOND
+#define FLUSH_BYTES (64 * 1024)
+
+/* The header takes up one record, so records stay aligned */
+struct Header {
+    gchar magic[8];
+    guint32 version;
+    guint32 record_size;
+    gint64 created;
+};
+
+G_STATIC_ASSERT(sizeof(PJournalRecord) == 24);
+G_STATIC_ASSERT(sizeof(struct Header) == sizeof(PJournalRecord));
+
+#define RECORD_OFFSET(index) \
+    ((goffset)((index) + 1) * (goffset)sizeof(PJournalRecord))
+
+struct _PJournal {
+    int fd;
+    guint64 count; /* records appended, including snapshots */
+    gint64 last_time;
+    GHashTable *state; /* latest record for each panel, kind and item */
+
+    /* shared with the writing thread */
+    GMutex lock;
+    GCond wake;
+    GByteArray *pending;
+    gboolean closing;
+    GError *error; /* set when writing failed; nothing is written after */
+    GThread *thread;
+};
+
+struct _PJournalReader {
+    int fd;
+};
+
+static const gchar *value_names[] = {
+    "signal", "raman_shift", "antistokes", "pump", "stokes", "probe",
+    "free_antistokes", "free_raman_shift"
+};
+
+const gchar *
+p_journal_item_name(const PJournalRecord *record)
+{
+    switch(P_JOURNAL_KIND(record)) {
+    case P_JOURNAL_VALUE:
+        if(record->item < G_N_ELEMENTS(value_names))
+            return value_names[record->item];
+        break;
+    case P_JOURNAL_LOCK:
+        if(record->item < CARS_NUM_FREE_QUANTITIES)
+            return value_names[CARS_NUM_OPO_QUANTITIES + record->item];
+        break;
+    case P_JOURNAL_MODE:
+        return "beam_combination";
+    case P_JOURNAL_DEGENERATE:
+        return "degenerate";
+    case P_JOURNAL_SESSION:
+        return "session";
+    }
+    return "unknown";
+}
+
+/* State tables */
+
+static guint64
+state_key(const PJournalRecord *record)
+{
+    return (guint64)record->panel << 32 |
+        (guint64)P_JOURNAL_KIND(record) << 16 | record->item;
+}
+
+static GHashTable *
+state_new(void)
+{
+    return g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free,
+        g_free);
+}
+
+static void
+state_update(GHashTable *state, const PJournalRecord *record)
+{
+    if(P_JOURNAL_KIND(record) == P_JOURNAL_SESSION) {
+        g_hash_table_remove_all(state);
+        return;
+    }
+    guint64 *key = g_new(guint64, 1);
+    PJournalRecord *copy = g_new(PJournalRecord, 1);
+    *key = state_key(record);
+    *copy = *record;
+    copy->kind = P_JOURNAL_KIND(record);
+    g_hash_table_replace(state, key, copy);
+}
+
+static gint
+compare_records(gconstpointer a, gconstpointer b)
+{
+    guint64 x = state_key(a), y = state_key(b);
+    return (x > y) - (x < y);
+}
+
+/* The state's records ordered by panel, kind and item */
+static GArray *
+state_records(GHashTable *state)
+{
+    GArray *records = g_array_sized_new(FALSE, FALSE, sizeof(PJournalRecord),
+        g_hash_table_size(state));
+    GHashTableIter iter;
+    gpointer record;
+    g_hash_table_iter_init(&iter, state);
+    while(g_hash_table_iter_next(&iter, NULL, &record))
+        g_array_append_vals(records, record, 1);
+    g_array_sort(records, compare_records);
+    return records;
+}
+
+/* Reading */
+
+static gboolean
+read_records(int fd, guint64 first, guint n, PJournalRecord *records)
+{
+    gsize size = n * sizeof(PJournalRecord), done = 0;
+    while(done < size) {
+        gssize result = pread(fd, (gchar *)records + done, size - done,
+            RECORD_OFFSET(first) + done);
+        if(result < 0 && errno == EINTR)
+            continue;
+        if(result <= 0)
+            return FALSE;
+        done += result;
+    }
+    return TRUE;
+}
+
+static guint64
+count_records(int fd)
+{
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size < RECORD_OFFSET(0))
+        return 0;
+    return info.st_size / sizeof(PJournalRecord) - 1;
+}
+
+/* First record of the last block that starts at or before "time", or of the
+first block if none does */
+static guint64
+find_block(int fd, guint64 count, gint64 time)
+{
+    guint64 low = 0, high = (count + P_JOURNAL_BLOCK_RECORDS - 1) /
+        P_JOURNAL_BLOCK_RECORDS;
+    while(high - low > 1) {
+        guint64 middle = low + (high - low) / 2;
+        PJournalRecord record;
+        if(!read_records(fd, middle * P_JOURNAL_BLOCK_RECORDS, 1, &record))
+            break;
+        if(record.time <= time)
+            low = middle;
+        else
+            high = middle;
+    }
+    return low * P_JOURNAL_BLOCK_RECORDS;
+}
+
+/* Call "func" on the records from the start of the block containing "start"
+until one is later than "end", or "func" returns FALSE */
+static void
+scan(int fd, gint64 start, gint64 end, PJournalFunc func, gpointer data)
+{
+    guint64 count = count_records(fd);
+    guint64 index = find_block(fd, count, start);
+    PJournalRecord *block = g_new(PJournalRecord, P_JOURNAL_BLOCK_RECORDS);
+    gboolean going = TRUE;
+
+    while(going && index < count) {
+        guint i, n = MIN(count - index, P_JOURNAL_BLOCK_RECORDS);
+        if(!read_records(fd, index, n, block))
+            break;
+        for(i = 0; going && i < n; i++) {
+            if(block[i].time > end)
+                going = FALSE;
+            else
+                going = func(block + i, data);
+        }
+        index += n;
+    }
+    g_free(block);
+}
+
+static gboolean
+check_header(int fd, const gchar *filename, GError **error)
+{
+    struct Header header;
+    if(pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != VERSION ||
+        header.record_size != sizeof(PJournalRecord)) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+            "%s is not a journal of this version", filename);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int
+open_file(const gchar *filename, int flags, GError **error)
+{
+    int fd = g_open(filename, flags, 0644);
+    if(fd < 0) {
+        int saved_errno = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+            "Cannot open %s: %s", filename, g_strerror(saved_errno));
+    }
+    return fd;
+}
+
+PJournalReader *
+p_journal_reader_open(const gchar *filename, GError **error)
+{
+    int fd = open_file(filename, O_RDONLY, error);
+    if(fd < 0)
+        return NULL;
+    if(!check_header(fd, filename, error)) {
+        close(fd);
+        return NULL;
+    }
+    PJournalReader *self = g_slice_new(PJournalReader);
+    self->fd = fd;
+    return self;
+}
+
+void
+p_journal_reader_close(PJournalReader *reader)
+{
+    close(reader->fd);
+    g_slice_free(PJournalReader, reader);
+}
+
+struct StateScan {
+    GHashTable *state;
+    gint64 time;
+};
+
+static gboolean
+apply_record(const PJournalRecord *record, struct StateScan *scan)
+{
+    state_update(scan->state, record);
+    scan->time = record->time;
+    return TRUE;
+}
+
+/* The latest record of each panel, kind and item at "time", without the
+snapshot flag. Free with g_array_free(). */
+GArray *
+p_journal_state_at(PJournalReader *reader, gint64 time)
+{
+    struct StateScan state_scan = { state_new(), 0 };
+    scan(reader->fd, time, time, (PJournalFunc)apply_record, &state_scan);
+    GArray *records = state_records(state_scan.state);
+    g_hash_table_unref(state_scan.state);
+    return records;
+}
+
+struct RangeScan {
+    gint64 start;
+    PJournalFunc func;
+    gpointer data;
+};
+
+static gboolean
+filter_record(const PJournalRecord *record, struct RangeScan *range)
+{
+    if(record->time < range->start || record->kind & P_JOURNAL_SNAPSHOT)
+        return TRUE;
+    return range->func(record, range->data);
+}
+
+/* Call "func" on each change from "start" to "end" inclusive, in order,
+until it returns FALSE */
+void
+p_journal_foreach(PJournalReader *reader, gint64 start, gint64 end,
+    PJournalFunc func, gpointer data)
+{
+    struct RangeScan range = { start, func, data };
+    scan(reader->fd, start, end, (PJournalFunc)filter_record, &range);
+}
+
+/* Writing */
+
+static gboolean
+write_all(int fd, const guint8 *data, gsize size)
+{
+    while(size > 0) {
+        gssize result = write(fd, data, size);
+        if(result < 0 && errno == EINTR)
+            continue;
+        if(result < 0)
+            return FALSE;
+        data += result;
+        size -= result;
+    }
+    return TRUE;
+}
+
+static gpointer
+write_thread(PJournal *self)
+{
+    GByteArray *batch = g_byte_array_new();
+    gboolean failed = FALSE, closing;
+    GError *error = NULL;
+
+    g_mutex_lock(&self->lock);
+    do {
+        /* Wait for the first change, then gather more for a while */
+        while(!self->closing && self->pending->len == 0)
+            g_cond_wait(&self->wake, &self->lock);
+        gint64 deadline = g_get_monotonic_time() + FLUSH_INTERVAL;
+        while(!self->closing && self->pending->len < FLUSH_BYTES &&
+            g_cond_wait_until(&self->wake, &self->lock, deadline))
+            ;
+        GByteArray *swap = self->pending;
+        self->pending = batch;
+        batch = swap;
+        closing = self->closing;
+        g_mutex_unlock(&self->lock);
+
+        if(batch->len > 0 && !failed) {
+            if(!write_all(self->fd, batch->data, batch->len) ||
+                fsync(self->fd) != 0) {
+                int saved_errno = errno;
+                g_set_error(&error, G_FILE_ERROR,
+                    g_file_error_from_errno(saved_errno),
+                    "Cannot write the journal: %s", g_strerror(saved_errno));
+                failed = TRUE;
+            }
+        }
+        g_byte_array_set_size(batch, 0);
+        g_mutex_lock(&self->lock);
+        if(error) {
+            self->error = error;
+            error = NULL;
+        }
+    } while(!closing);
+    g_mutex_unlock(&self->lock);
+
+    g_byte_array_free(batch, TRUE);
+    return NULL;
+}
+
+static void
+append(PJournal *self, const PJournalRecord *record)
+{
+    g_mutex_lock(&self->lock);
+    gboolean was_empty = self->pending->len == 0;
+    g_byte_array_append(self->pending, (const guint8 *)record,
+        sizeof(PJournalRecord));
+    if(was_empty || self->pending->len >= FLUSH_BYTES)
+        g_cond_signal(&self->wake);
+    g_mutex_unlock(&self->lock);
+    self->count++;
+}
+
+static gboolean
+restore_state(const PJournalRecord *record, PJournal *self)
+{
+    state_update(self->state, record);
+    self->last_time = record->time;
+    return TRUE;
+}
+
+static void
+add_record(PJournal *self, guint panel, PJournalKind kind, guint item,
+    gdouble value)
+{
+    /* Keep time from going backwards when the clock is set */
+    gint64 now = MAX(g_get_real_time(), self->last_time);
+    PJournalRecord record = { now, panel, kind, item, value };
+    self->last_time = now;
+
+    if(self->count % P_JOURNAL_BLOCK_RECORDS == 0) {
+        GArray *snapshot = state_records(self->state);
+        guint i;
+        for(i = 0; i < snapshot->len; i++) {
+            PJournalRecord *old = &g_array_index(snapshot, PJournalRecord, i);
+            old->time = now;
+            old->kind |= P_JOURNAL_SNAPSHOT;
+            append(self, old);
+        }
+        g_array_free(snapshot, TRUE);
+    }
+    append(self, &record);
+    state_update(self->state, &record);
+}
+
+/* Open a journal for appending, creating it if needed, and start a session */
+PJournal *
+p_journal_open(const gchar *filename, GError **error)
+{
+    int fd = open_file(filename, O_RDWR | O_CREAT, error);
+    if(fd < 0)
+        return NULL;
+    if(flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        int saved_errno = errno;
+        if(saved_errno == EWOULDBLOCK)
+            g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                "%s is already being written by another process", filename);
+        else
+            g_set_error(error, G_FILE_ERROR,
+                g_file_error_from_errno(saved_errno), "Cannot lock %s: %s",
+                filename, g_strerror(saved_errno));
+        close(fd);
+        return NULL;
+    }
+
+    PJournal *self = g_slice_new0(PJournal);
+    self->fd = fd;
+    self->state = state_new();
+    struct stat info;
+    if(fstat(fd, &info) == 0 && info.st_size == 0) {
+        struct Header header = {
+            MAGIC, VERSION, sizeof(PJournalRecord), g_get_real_time()
+        };
+        if(!write_all(fd, (const guint8 *)&header, sizeof(header))) {
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Cannot write %s: %s", filename, g_strerror(errno));
+            goto fail;
+        }
+    } else {
+        if(!check_header(fd, filename, error))
+            goto fail;
+        /* Drop a record cut short by a crash, and pick up where the last
+        session left off */
+        self->count = count_records(fd);
+        if(ftruncate(fd, RECORD_OFFSET(self->count)) != 0 ||
+            lseek(fd, 0, SEEK_END) < 0) {
+            g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Cannot write %s: %s", filename, g_strerror(errno));
+            goto fail;
+        }
+        scan(fd, G_MAXINT64, G_MAXINT64, (PJournalFunc)restore_state, self);
+    }
+
+    g_mutex_init(&self->lock);
+    g_cond_init(&self->wake);
+    self->pending = g_byte_array_new();
+    add_record(self, 0, P_JOURNAL_SESSION, 0, 0.0);
+    self->thread = g_thread_new("journal", (GThreadFunc)write_thread, self);
+    return self;
+
+fail:
+    close(fd);
+    g_hash_table_unref(self->state);
+    g_slice_free(PJournal, self);
+    return NULL;
+}
+
+/* Record a change. Called from the main thread only. Returns FALSE once
+writing the journal has failed; the change and all later ones are lost. */
+gboolean
+p_journal_add(PJournal *journal, guint panel, PJournalKind kind, guint item,
+    gdouble value, GError **error)
+{
+    g_mutex_lock(&journal->lock);
+    if(journal->error) {
+        g_propagate_error(error, g_error_copy(journal->error));
+        g_mutex_unlock(&journal->lock);
+        return FALSE;
+    }
+    g_mutex_unlock(&journal->lock);
+
+    add_record(journal, panel, kind, item, value);
+    return TRUE;
+}
+
+/* Write everything that is pending and close the file. Returns FALSE if any
+change could not be written. */
+gboolean
+p_journal_close(PJournal *journal, GError **error)
+{
+    g_mutex_lock(&journal->lock);
+    journal->closing = TRUE;
+    g_cond_signal(&journal->wake);
+    g_mutex_unlock(&journal->lock);
+    g_thread_join(journal->thread);
+
+    gboolean ok = journal->error == NULL;
+    if(!ok)
+        g_propagate_error(error, journal->error);
+    close(journal->fd);
+    g_byte_array_free(journal->pending, TRUE);
+    g_hash_table_unref(journal->state);
+    g_mutex_clear(&journal->lock);
+    g_cond_clear(&journal->wake);
+    g_slice_free(PJournal, journal);
+    return ok;
+}
@@ -0,0 +1,69 @@
+#ifndef __P_JOURNAL_H__
+#define __P_JOURNAL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* An append-only file of fixed-size records, one per committed change to a
+calculator panel. Records are written in batches and synced to disk by a
+background thread. The file is divided into blocks of P_JOURNAL_BLOCK_RECORDS
+records. Each block starts with a snapshot of the whole state, so looking up
+the state at a time only needs a binary search over the first record of each
+block and a scan of one block. Every session starts with a P_JOURNAL_SESSION
+record, after which only the panels that the session records are current.
+One process at a time can append to a journal. Numbers are stored in the
+host's byte order. */
+
+typedef enum {
+    /* item: CarsOpoQuantity, or CARS_NUM_OPO_QUANTITIES + CarsFreeQuantity;
+    value in SI units */
+    P_JOURNAL_VALUE,
+    /* item: CarsFreeQuantity; value 0 or 1 */
+    P_JOURNAL_LOCK,
+    /* value: CarsBeamCombination */
+    P_JOURNAL_MODE,
+    /* value: 0 or 1 */
+    P_JOURNAL_DEGENERATE,
+    /* Clears the state of all panels; panel, item and value are 0 */
+    P_JOURNAL_SESSION,
+    P_JOURNAL_NUM_KINDS
+} PJournalKind;
+
+/* Set in the kind of records that repeat the state at the start of a block */
+#define P_JOURNAL_SNAPSHOT 0x8000
+#define P_JOURNAL_KIND(record) ((record)->kind & ~P_JOURNAL_SNAPSHOT)
+
+#define P_JOURNAL_BLOCK_RECORDS 4096
+
+typedef struct {
+    gint64 time; /* microseconds since the epoch, never decreasing */
+    guint32 panel; /* numbered from 1 */
+    guint16 kind;
+    guint16 item;
+    gdouble value;
+} PJournalRecord;
+
+typedef struct _PJournal PJournal;
+
+PJournal *p_journal_open(const gchar *filename, GError **error);
+gboolean p_journal_add(PJournal *journal, guint panel, PJournalKind kind,
+    guint item, gdouble value, GError **error);
+gboolean p_journal_close(PJournal *journal, GError **error);
+
+/* Name of the widget in interface.xml that shows the record's item */
+const gchar *p_journal_item_name(const PJournalRecord *record);
+
+/* Reading a journal, which may still be appended to by another process */
+typedef struct _PJournalReader PJournalReader;
+typedef gboolean (*PJournalFunc)(const PJournalRecord *record, gpointer data);
+
+PJournalReader *p_journal_reader_open(const gchar *filename, GError **error);
+void p_journal_reader_close(PJournalReader *reader);
+GArray *p_journal_state_at(PJournalReader *reader, gint64 time);
+void p_journal_foreach(PJournalReader *reader, gint64 start, gint64 end,
+    PJournalFunc func, gpointer data);
+
+G_END_DECLS
+
+#endif // __P_JOURNAL_H__
@@ -2,541 +2,460 @@
 #include <gtk/gtk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
+#include "cars.h"
+#include "graph.h"
 #include "interface.h"
+#include "journal.h"
 #include "quantity.h"
+#include "replay.h"
 #include "oslogo.h"
 
 #define HANDLE_ERROR(string, error) \
     if(error) g_error("(%s): %s: %s", __func__, string, error->message);
-#define SPEED_OF_LIGHT 2.99792458e8
-#define PLANCK 6.62606896e-34
-#define PUMP_WAVELENGTH (1064.1e-9 / 2)
-
-enum BeamCombination {
-    SIGNAL_IDLER,
-    SIGNAL_1064,
-    IDLER_1064,
-    NUM_BEAM_COMBINATIONS
-};
-enum BeamUnit {
-    WAVELENGTHS,
-    FREQUENCIES,
-    NUM_BEAM_UNITS
+
+/* Shared by the quantities of all panels */
+static const PQuantityUnitInfo beam_units[] = {
+    { "nm", 1.0e9, FALSE, 1, 0.1 },
+    { "THz", CARS_SPEED_OF_LIGHT * 1.0e-12, TRUE, 1, 0.1 }
 };
-enum EnergyUnit {
-    WAVENUMBERS,
-    TERAHERTZ,
-    ZEPTOJOULES,
-    NUM_ENERGY_UNITS
+static const PQuantityUnitInfo energy_units[] = {
+    { "cm<sup>-1</sup>", 1.0e-2, FALSE, 0, 1 },
+    { "THz", CARS_SPEED_OF_LIGHT * 1.0e-12, FALSE, 1, 0.1 },
+    { "zJ", CARS_PLANCK * CARS_SPEED_OF_LIGHT * 1.0e21, FALSE, 2, 0.01 }
 };
-enum LockFlags {
-    PUMP_UNLOCK = 1 << 0,
-    PUMP_LOCK = 1 << 1,
-    STOKES_UNLOCK = 1 << 2,
-    STOKES_LOCK = 1 << 3,
-    PROBE_UNLOCK = 1 << 4,
-    PROBE_LOCK = 1 << 5,
-    ANTISTOKES_UNLOCK = 1 << 6,
-    ANTISTOKES_LOCK = 1 << 7,
-    RAMAN_UNLOCK = 1 << 8,
-    RAMAN_LOCK = 1 << 9
+
+static const gchar *free_names[] = {
+    "pump", "Stokes", "probe", "anti-Stokes", "Raman shift"
 };
 
-static PQuantityUnitInfo beam_units[] = {
-    { "nm", 1.0e9, FALSE, 1, 0.1 },
-    { "THz", SPEED_OF_LIGHT * 1.0e-12, TRUE, 1, 0.1 }
+/* Objects in interface.xml that make up one calculator panel */
+static gchar *panel_objects[] = {
+    "panel", "model1", "model2", "adjustment1", "adjustment2", "adjustment3",
+    "adjustment4", "adjustment5", "adjustment6", "adjustment7", "adjustment8",
+    NULL
 };
-static PQuantityUnitInfo energy_units[] = {
-    { "cm<sup>-1</sup>", 1.0e-2, FALSE, 0, 1 },
-    { "THz", SPEED_OF_LIGHT * 1.0e-12, FALSE, 1, 0.1 },
-    { "zJ", PLANCK * SPEED_OF_LIGHT * 1.0e21, FALSE, 2, 0.01 }
+
+/* Nodes of a panel's dependency graph: the OPO quantities, then the free
+beams */
+#define OPO_NODE(quantity) (quantity)
+#define FREE_NODE(quantity) (CARS_NUM_OPO_QUANTITIES + (quantity))
+#define NUM_NODES FREE_NODE(CARS_NUM_FREE_QUANTITIES)
+
+static gint num_panels = 1;
+static gchar *tuning_table_file = NULL;
+static gchar *record_file = NULL;
+static gchar *replay_file = NULL;
+static gdouble replay_speed = 1.0;
+static gdouble max_latency = 0.0;
+static gchar *journal_file = NULL;
+static GOptionEntry options[] = {
+    { "panels", 'n', 0, G_OPTION_ARG_INT, &num_panels,
+        "Number of calculator panels to show", "N" },
+    { "tuning-table", 't', 0, G_OPTION_ARG_FILENAME, &tuning_table_file,
+        "Show OPO control settings from a vendor tuning table", "FILE" },
+    { "journal", 'j', 0, G_OPTION_ARG_FILENAME, &journal_file,
+        "Append every change of the calculators to a journal file", "FILE" },
+    { "record", 0, 0, G_OPTION_ARG_FILENAME, &record_file,
+        "Record user input to a trace file", "FILE" },
+    { "replay", 0, 0, G_OPTION_ARG_FILENAME, &replay_file,
+        "Replay a trace file, report latencies and quit", "FILE" },
+    { "replay-speed", 0, 0, G_OPTION_ARG_DOUBLE, &replay_speed,
+        "Speed factor for --replay, 0 for as fast as possible", "X" },
+    { "max-latency", 0, 0, G_OPTION_ARG_DOUBLE, &max_latency,
+        "Fail if the 99th percentile frame latency of --replay exceeds MS",
+        "MS" },
+    { NULL }
 };
 
+/* Shared by all panels; NULL if no table was given */
+static CarsTuningTable *tuning_table = NULL;
+static PJournal *journal = NULL;
+
+/* State of one calculator panel */
 struct Data {
     /* widgets */
-    GtkWidget *main_window;
+    GtkWidget *panel;
     GtkWidget *beam_combination;
     GtkWidget *beam_units;
     GtkWidget *energy_units;
-    GtkWidget *degenerate_box;
-
-    /* Quantity displays */
-    PQuantity *raman;
-    PQuantity *signal;
-    PQuantity *antistokes;
-    PQuantity *pump;
-    PQuantity *stokes;
-    PQuantity *probe;
-    PQuantity *free_antistokes;
-    PQuantity *free_raman;
+    GtkWidget *signal_tuning;
+    GtkWidget *antistokes_tuning;
+    GtkWidget *lock_info;
+    GtkWidget *lock_message;
+
+    /* Quantity displays, indexed by CarsOpoQuantity and CarsFreeQuantity */
+    PQuantity *opo[CARS_NUM_OPO_QUANTITIES];
+    PQuantity *free[CARS_NUM_FREE_QUANTITIES];
+    PGraph *graph;
 
     /* state */
-    enum EnergyUnit units;
-    enum BeamUnit display;
-    enum BeamCombination mode;
+    guint number; /* of the panel, from 1 */
+    CarsEnergyUnit units;
+    CarsBeamUnit display;
+    CarsBeamCombination mode;
     gboolean degenerate;
-    guint link_handler[2];
+    guint failed_node; /* edit that the locks prevented */
+    unsigned release; /* locks to release to allow it */
 };
-static struct Data *d = NULL;
 
-static void
-calculate_opo_from_signal(void)
+static PQuantity *
+node_quantity(struct Data *d, guint node)
 {
-    gdouble signal = p_quantity_get_value(d->signal);
-    gdouble invpump = 1.0 / PUMP_WAVELENGTH;
-    gdouble raman = 0.0, antistokes = 0.0;
-
-    switch(d->mode) {
-        case SIGNAL_IDLER:
-            raman = 2.0 / signal - invpump;
-            antistokes = 1.0 / (3.0 / signal - invpump);
-            break;
-        case SIGNAL_1064:
-            raman = 1.0 / signal - 0.5 * invpump;
-            antistokes = 1.0 / (2.0 / signal - 0.5 * invpump);
-            break;
-        case IDLER_1064:
-            raman = 1.0 / signal - 0.5 * invpump;
-            antistokes = signal;
-            break;
-        default:
-            g_assert_not_reached();
-    }
-
-    p_quantity_set_value_no_notify(d->raman, raman);
-    p_quantity_set_value_no_notify(d->antistokes, antistokes);
+    if(node < FREE_NODE(0))
+        return d->opo[node - OPO_NODE(0)];
+    return d->free[node - FREE_NODE(0)];
 }
 
+/* If the journal cannot be written, tell the user once, without blocking
+the main loop */
 static void
-calculate_opo_from_raman(void)
+journal_add(struct Data *d, PJournalKind kind, guint item, gdouble value)
 {
-    double raman = p_quantity_get_value(d->raman);
-    double invpump = 1.0 / PUMP_WAVELENGTH;
-    double signal = 0.0, antistokes = 0.0;
-
-    switch(d->mode) {
-        case SIGNAL_IDLER:
-            signal = 2.0 / (raman + invpump);
-            antistokes = 1.0 / (3.0 / signal - invpump);
-            break;
-        case SIGNAL_1064:
-            signal = 1.0 / (raman + 0.5 * invpump);
-            antistokes = 1.0 / (2.0 / signal - 0.5 * invpump);
-            break;
-        case IDLER_1064:
-            signal = 1.0 / (raman + 0.5 * invpump);
-            antistokes = signal;
-            break;
-        default:
-            g_assert_not_reached();
-    }
+    static gboolean failed = FALSE;
+    GError *error = NULL;
 
-    p_quantity_set_value_no_notify(d->signal, signal);
-    p_quantity_set_value_no_notify(d->antistokes, antistokes);
+    if(journal == NULL || failed ||
+        p_journal_add(journal, d->number, kind, item, value, &error))
+        return;
+    failed = TRUE;
+    GtkWidget *dialog = gtk_message_dialog_new(
+        GTK_WINDOW(gtk_widget_get_toplevel(d->panel)),
+        GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+        "%s. Changes are no longer recorded.", error->message);
+    g_signal_connect(dialog, "response", G_CALLBACK(gtk_widget_destroy), NULL);
+    gtk_widget_show(dialog);
+    g_error_free(error);
 }
 
+/* Record the whole state of a panel, when it starts */
 static void
-calculate_opo_from_antistokes(void)
+journal_add_panel(struct Data *d)
 {
-    double antistokes = p_quantity_get_value(d->antistokes);
-    double invpump = 1.0 / PUMP_WAVELENGTH;
-    double raman = 0.0, signal = 0.0;
-
-    switch(d->mode) {
-        case SIGNAL_IDLER:
-            signal = 3.0 / (1.0 / antistokes + invpump);
-            raman = 2.0 / signal - invpump;
-            break;
-        case SIGNAL_1064:
-            signal = 2.0 / (1.0 / antistokes + 0.5 * invpump);
-            raman = 1.0 / signal - 0.5 * invpump;
-            break;
-        case IDLER_1064:
-            signal = antistokes;
-            raman = 1.0 / signal - 0.5 * invpump;
-            break;
-        default:
-            g_assert_not_reached();
-    }
-
-    p_quantity_set_value_no_notify(d->raman, raman);
-    p_quantity_set_value_no_notify(d->signal, signal);
-
+    guint node;
+    int i;
+    for(node = 0; node < NUM_NODES; node++)
+        journal_add(d, P_JOURNAL_VALUE, node,
+            p_quantity_get_value(node_quantity(d, node)));
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++)
+        journal_add(d, P_JOURNAL_LOCK, i,
+            p_quantity_get_locked(d->free[i]));
+    journal_add(d, P_JOURNAL_MODE, 0, d->mode);
+    journal_add(d, P_JOURNAL_DEGENERATE, 0, d->degenerate);
 }
 
-static gboolean
-check_locked(guint flags)
+static void
+set_consistent(struct Data *d)
 {
-    if(flags & PUMP_UNLOCK && p_quantity_get_locked(d->pump))
-        return FALSE;
-    if(flags & PUMP_LOCK && !p_quantity_get_locked(d->pump))
-        return FALSE;
-    if(flags & STOKES_UNLOCK && p_quantity_get_locked(d->stokes))
-        return FALSE;
-    if(flags & STOKES_LOCK && !p_quantity_get_locked(d->stokes))
-        return FALSE;
-    if(flags & PROBE_UNLOCK && p_quantity_get_locked(d->probe))
-        return FALSE;
-    if(flags & PROBE_LOCK && !p_quantity_get_locked(d->probe))
-        return FALSE;
-    if(flags & ANTISTOKES_UNLOCK && p_quantity_get_locked(d->free_antistokes))
-        return FALSE;
-    if(flags & ANTISTOKES_LOCK && !p_quantity_get_locked(d->free_antistokes))
-        return FALSE;
-    if(flags & RAMAN_UNLOCK && p_quantity_get_locked(d->free_raman))
-        return FALSE;
-    if(flags & RAMAN_LOCK && !p_quantity_get_locked(d->free_raman))
-        return FALSE;
-    return TRUE;
+    int i;
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++)
+        p_quantity_set_inconsistent(d->free[i], FALSE);
+    gtk_widget_hide(d->lock_info);
 }
 
-static void
-error_locked(PQuantity *quantity)
+static unsigned
+get_locked(struct Data *d)
 {
-    p_quantity_set_inconsistent(quantity, TRUE);
-    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(d->main_window),
-        GTK_DIALOG_DESTROY_WITH_PARENT, GTK_MESSAGE_WARNING, GTK_BUTTONS_OK,
-        "You have locked too many parameters to complete that calculation.");
-    gtk_dialog_run(GTK_DIALOG(dialog));
-    gtk_widget_destroy(dialog);
+    unsigned locked = 0;
+    int i;
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++)
+        if(p_quantity_get_locked(d->free[i]))
+            locked |= CARS_LOCKED(i);
+    return locked;
 }
 
+/* Show the OPO control settings for the current signal wavelength, which
+produces both the signal and the anti-Stokes beams */
 static void
-set_consistent(void)
+update_tuning(struct Data *d)
 {
-    p_quantity_set_inconsistent(d->pump, FALSE);
-    p_quantity_set_inconsistent(d->stokes, FALSE);
-    p_quantity_set_inconsistent(d->probe, FALSE);
-    p_quantity_set_inconsistent(d->free_antistokes, FALSE);
-    p_quantity_set_inconsistent(d->free_raman, FALSE);
+    if(tuning_table == NULL)
+        return;
+
+    gdouble signal = p_graph_get_value(d->graph, OPO_NODE(CARS_OPO_SIGNAL));
+    gdouble temperature, cavity;
+    int channel;
+    cars_tuning_lookup(tuning_table, &signal, &channel, &temperature, &cavity,
+        1);
+    gchar *text = channel < 0? g_strdup("Out of tuning range") :
+        g_strdup_printf("Channel %d, %.1f \302\260C, %.3f mm", channel,
+            temperature, cavity * 1.0e3);
+    gtk_label_set_text(GTK_LABEL(d->signal_tuning), text);
+    gtk_label_set_text(GTK_LABEL(d->antistokes_tuning), text);
+    g_free(text);
 }
 
-static void
-calculate_free_from_pump(void)
+/* "the pump, Stokes and probe" */
+static gchar *
+describe_quantities(unsigned mask, gboolean *plural)
 {
-    gdouble pump = p_quantity_get_value(d->pump);
-    if(check_locked(ANTISTOKES_UNLOCK | RAMAN_UNLOCK)) {
-        gdouble stokes = p_quantity_get_value(d->stokes);
-        gdouble probe = p_quantity_get_value(d->probe);
-        p_quantity_set_value_no_notify(d->free_raman,
-            1.0 / pump - 1.0 / stokes);
-        p_quantity_set_value_no_notify(d->free_antistokes,
-            1.0 / (1.0 / pump - 1.0 / stokes + 1.0 / probe));
-    } else if(check_locked(RAMAN_LOCK | ANTISTOKES_UNLOCK | STOKES_UNLOCK)) {
-        gdouble raman = p_quantity_get_value(d->free_raman);
-        gdouble probe = p_quantity_get_value(d->probe);
-        gdouble stokes = 1.0 / (1.0 / pump - raman);
-        p_quantity_set_value_no_notify(d->stokes, stokes);
-        p_quantity_set_value_no_notify(d->free_antistokes,
-            1.0 / (1.0 / pump - 1.0 / stokes + 1.0 / probe));
-    } else if(check_locked(ANTISTOKES_LOCK | RAMAN_UNLOCK | STOKES_UNLOCK)) {
-        gdouble antistokes = p_quantity_get_value(d->free_antistokes);
-        gdouble probe = p_quantity_get_value(d->probe);
-        gdouble raman = 1.0 / antistokes - 1.0 / probe;
-        p_quantity_set_value_no_notify(d->free_raman, raman);
-        p_quantity_set_value_no_notify(d->stokes, 1.0 / (1.0 / pump - raman));
-    } else if(!d->degenerate &&
-        check_locked(ANTISTOKES_LOCK | RAMAN_LOCK | STOKES_UNLOCK)) {
-        gdouble raman = p_quantity_get_value(d->free_raman);
-        p_quantity_set_value_no_notify(d->stokes,
-            1.0 / (1.0 / pump - raman));
-    } else if(!d->degenerate && check_locked(STOKES_LOCK | ANTISTOKES_LOCK |
-        PROBE_UNLOCK | RAMAN_UNLOCK)) {
-        gdouble stokes = p_quantity_get_value(d->stokes);
-        gdouble antistokes = p_quantity_get_value(d->free_antistokes);
-        gdouble raman = 1.0 / pump - 1.0 / stokes;
-        p_quantity_set_value_no_notify(d->free_raman, raman);
-        p_quantity_set_value_no_notify(d->probe,
-            1.0 / (1.0 / antistokes - raman));
-    } else {
-        error_locked(d->pump);
-        return;
+    GString *text = g_string_new("the ");
+    int i, count = 0, total = 0;
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++)
+        if(mask & CARS_LOCKED(i))
+            total++;
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++) {
+        if(!(mask & CARS_LOCKED(i)))
+            continue;
+        if(count > 0)
+            g_string_append(text, count == total - 1? " and " : ", ");
+        g_string_append(text, free_names[i]);
+        count++;
     }
-    set_consistent();
+    if(plural)
+        *plural = total > 1;
+    return g_string_free(text, FALSE);
 }
 
+/* Report the conflicting locks inline, without blocking the main loop, and
+offer to release the smallest set of them */
 static void
-calculate_free_from_stokes(void)
+error_locked(struct Data *d, guint node)
 {
-    gdouble stokes = p_quantity_get_value(d->stokes);
-    if(check_locked(ANTISTOKES_UNLOCK | RAMAN_UNLOCK)) {
-        gdouble pump = p_quantity_get_value(d->pump);
-        gdouble probe = p_quantity_get_value(d->probe);
-        p_quantity_set_value_no_notify(d->free_raman,
-            1.0 / pump - 1.0 / stokes);
-        p_quantity_set_value_no_notify(d->free_antistokes,
-            1.0 / (1.0 / pump - 1.0 / stokes + 1.0 / probe));
-    } else if(check_locked(RAMAN_LOCK | ANTISTOKES_UNLOCK |
-        PUMP_UNLOCK | PROBE_UNLOCK)) {
-        gdouble raman = p_quantity_get_value(d->free_raman);
-        gdouble pump = 1.0 / (1.0 / stokes + raman);
-        gdouble probe = d->degenerate? pump : p_quantity_get_value(d->probe);
-        p_quantity_set_value_no_notify(d->pump, pump);
-        p_quantity_set_value_no_notify(d->probe, probe);
-        p_quantity_set_value_no_notify(d->free_antistokes,
-            1.0 / (1.0 / pump - 1.0 / stokes + 1.0 / probe));
-    } else if(!d->degenerate && check_locked(ANTISTOKES_LOCK | PUMP_UNLOCK)) {
-        gdouble raman = p_quantity_get_value(d->free_raman);
-        p_quantity_set_value_no_notify(d->pump,
-            1.0 / (1.0 / stokes + raman));
-    } else if(!d->degenerate && check_locked(ANTISTOKES_LOCK | PUMP_LOCK |
-        PROBE_UNLOCK | RAMAN_UNLOCK)) {
-        gdouble pump = p_quantity_get_value(d->pump);
-        gdouble antistokes = p_quantity_get_value(d->free_antistokes);
-        gdouble raman = 1.0 / pump - 1.0 / stokes;
-        p_quantity_set_value_no_notify(d->free_raman, raman);
-        p_quantity_set_value_no_notify(d->probe,
-            1.0 / (1.0 / antistokes - raman));
-    } else {
-        error_locked(d->stokes);
-        return;
-    }
-    set_consistent();
+    CarsFreeQuantity changed = node - FREE_NODE(0);
+    unsigned conflicting, release;
+    gboolean plural;
+
+    p_quantity_set_inconsistent(node_quantity(d, node), TRUE);
+    cars_free_diagnose(changed, get_locked(d), d->degenerate, &conflicting,
+        &release);
+    gchar *locks = describe_quantities(conflicting, &plural);
+    gchar *unlock = describe_quantities(release, NULL);
+    gchar *text = g_strdup_printf("Cannot recalculate after changing the %s, "
+        "because %s %s locked. Unlock %s to continue.", free_names[changed],
+        locks, plural? "are" : "is", unlock);
+    gtk_label_set_text(GTK_LABEL(d->lock_message), text);
+    g_free(text);
+    g_free(locks);
+    g_free(unlock);
+
+    d->failed_node = node;
+    d->release = release;
+    gtk_widget_show(d->lock_info);
 }
 
-static void
-calculate_free_from_probe(void)
+/* The OPO quantities all follow from the signal: an edited Raman shift or
+anti-Stokes wavelength gives a new signal, which then gives the other one */
+static gboolean
+solve_signal(guint edited, gdouble *values, guint64 *written, gpointer data)
 {
-    gdouble probe = p_quantity_get_value(d->probe);
-    if(!d->degenerate && check_locked(ANTISTOKES_UNLOCK)) {
-        gdouble raman = p_quantity_get_value(d->free_raman);
-        p_quantity_set_value_no_notify(d->free_antistokes,
-            1.0 / (1.0 / probe + raman));
-    } else if(check_locked(ANTISTOKES_UNLOCK | RAMAN_UNLOCK)) {
-        gdouble stokes = p_quantity_get_value(d->stokes);
-        gdouble pump = p_quantity_get_value(d->pump);
-        p_quantity_set_value_no_notify(d->free_raman,
-            1.0 / pump - 1.0 / stokes);
-        p_quantity_set_value_no_notify(d->free_antistokes,
-            1.0 / (1.0 / pump - 1.0 / stokes + 1.0 / probe));
-    } else if(check_locked(RAMAN_LOCK | ANTISTOKES_UNLOCK | STOKES_UNLOCK)) {
-        gdouble raman = p_quantity_get_value(d->free_raman);
-        gdouble pump = p_quantity_get_value(d->pump);
-        p_quantity_set_value_no_notify(d->free_antistokes,
-            1.0 / (1.0 / probe + raman));
-        p_quantity_set_value_no_notify(d->stokes, 1.0 / (1.0 / pump - raman));
-    } else if(check_locked(ANTISTOKES_LOCK | RAMAN_UNLOCK | STOKES_UNLOCK)) {
-        gdouble antistokes = p_quantity_get_value(d->free_antistokes);
-        gdouble pump = p_quantity_get_value(d->pump);
-        gdouble raman = 1.0 / antistokes - 1.0 / probe;
-        p_quantity_set_value_no_notify(d->free_raman, raman);
-        p_quantity_set_value_no_notify(d->stokes, 1.0 / (1.0 / pump - raman));
-    } else if(!d->degenerate && check_locked(STOKES_LOCK | ANTISTOKES_LOCK |
-        PUMP_UNLOCK | RAMAN_UNLOCK)) {
-        gdouble stokes = p_quantity_get_value(d->stokes);
-        gdouble antistokes = p_quantity_get_value(d->free_antistokes);
-        gdouble raman = 1.0 / antistokes - 1.0 / probe;
-        p_quantity_set_value_no_notify(d->free_raman, raman);
-        p_quantity_set_value_no_notify(d->pump,
-            1.0 / (1.0 / stokes + raman));
-    } else {
-        error_locked(d->probe);
-        return;
-    }
-    set_consistent();
+    struct Data *d = data;
+    cars_opo_solve(d->mode, edited - OPO_NODE(0),
+        values + OPO_NODE(CARS_OPO_SIGNAL), values + OPO_NODE(CARS_OPO_RAMAN),
+        values + OPO_NODE(CARS_OPO_ANTISTOKES), 1);
+    return TRUE;
+}
+
+static gboolean
+solve_from_signal(guint edited, gdouble *values, guint64 *written,
+    gpointer data)
+{
+    struct Data *d = data;
+    cars_opo_solve(d->mode, CARS_OPO_SIGNAL,
+        values + OPO_NODE(CARS_OPO_SIGNAL), values + OPO_NODE(CARS_OPO_RAMAN),
+        values + OPO_NODE(CARS_OPO_ANTISTOKES), 1);
+    return TRUE;
+}
+
+static gboolean
+solve_free(guint edited, gdouble *values, guint64 *written, gpointer data)
+{
+    struct Data *d = data;
+    unsigned mask;
+    if(cars_free_solve(edited - FREE_NODE(0), get_locked(d), d->degenerate,
+        values + FREE_NODE(0), 1, &mask) != CARS_OK)
+        return FALSE;
+    *written = (guint64)mask << FREE_NODE(0);
+    return TRUE;
 }
 
 static void
-calculate_free_from_antistokes(void)
+on_node_changed(guint node, gdouble value, struct Data *d)
 {
-    gdouble antistokes = p_quantity_get_value(d->free_antistokes);
-    if(!d->degenerate && check_locked(PROBE_UNLOCK)) {
-        gdouble raman = p_quantity_get_value(d->free_raman);
-        p_quantity_set_value_no_notify(d->probe,
-            1.0 / (1.0 / antistokes - raman));
-    } else if(d->degenerate && check_locked(PROBE_UNLOCK | STOKES_UNLOCK)) {
-        gdouble raman = p_quantity_get_value(d->free_raman);
-        gdouble probe = 1.0 / (1.0 / antistokes - raman);
-        p_quantity_set_value_no_notify(d->pump, probe);
-        p_quantity_set_value_no_notify(d->probe, probe);
-        p_quantity_set_value_no_notify(d->stokes,
-            1.0 / (1.0 / probe - raman));
-    } else if(check_locked(PROBE_LOCK | RAMAN_UNLOCK | STOKES_UNLOCK)) {
-        gdouble probe = p_quantity_get_value(d->probe);
-        gdouble pump = p_quantity_get_value(d->pump);
-        gdouble raman = 1.0 / antistokes - 1.0 / probe;
-        p_quantity_set_value_no_notify(d->free_raman, raman);
-        p_quantity_set_value_no_notify(d->stokes, 1.0 / (1.0 / pump - raman));
-    } else if(!d->degenerate && check_locked(STOKES_LOCK | PROBE_LOCK |
-        PUMP_UNLOCK | RAMAN_UNLOCK)) {
-        gdouble stokes = p_quantity_get_value(d->stokes);
-        gdouble probe = p_quantity_get_value(d->probe);
-        gdouble raman = 1.0 / antistokes - 1.0 / probe;
-        p_quantity_set_value_no_notify(d->free_raman, raman);
-        p_quantity_set_value_no_notify(d->pump,
-            1.0 / (1.0 / stokes + raman));
-    } else {
-        error_locked(d->free_antistokes);
-        return;
-    }
-    set_consistent();
+    p_quantity_set_value_no_notify(node_quantity(d, node), value);
+    journal_add(d, P_JOURNAL_VALUE, node, value);
 }
 
 static void
-calculate_free_from_raman(void)
+on_quantity_changed(PQuantity *quantity, gdouble value, struct Data *d)
 {
-    gdouble raman = p_quantity_get_value(d->free_raman);
-    if(!d->degenerate && check_locked(STOKES_UNLOCK | PROBE_UNLOCK)) {
-        gdouble pump = p_quantity_get_value(d->pump);
-        gdouble antistokes = p_quantity_get_value(d->free_antistokes);
-        p_quantity_set_value_no_notify(d->stokes,
-            1.0 / (1.0 / pump - raman));
-        p_quantity_set_value_no_notify(d->probe,
-            1.0 / (1.0 / antistokes - raman));
-    } else if(check_locked(STOKES_UNLOCK | ANTISTOKES_UNLOCK)) {
-        gdouble pump = p_quantity_get_value(d->pump);
-        gdouble probe = p_quantity_get_value(d->probe);
-        p_quantity_set_value_no_notify(d->stokes,
-            1.0 / (1.0 / pump - raman));
-        p_quantity_set_value_no_notify(d->free_antistokes,
-            1.0 / (1.0 / probe + raman));
-    } else if(check_locked(STOKES_LOCK | PUMP_UNLOCK | ANTISTOKES_UNLOCK)) {
-        gdouble stokes = p_quantity_get_value(d->stokes);
-        gdouble pump = 1.0 / (1.0 / stokes + raman);
-        gdouble probe = d->degenerate? pump : p_quantity_get_value(d->probe);
-        p_quantity_set_value_no_notify(d->pump, pump);
-        if(d->degenerate)
-            p_quantity_set_value_no_notify(d->probe, probe);
-        p_quantity_set_value_no_notify(d->free_antistokes,
-            1.0 / (1.0 / probe + raman));
-    } else if(!d->degenerate && check_locked(STOKES_LOCK | ANTISTOKES_LOCK |
-        PUMP_UNLOCK | PROBE_UNLOCK)) {
-        gdouble stokes = p_quantity_get_value(d->stokes);
-        gdouble antistokes = p_quantity_get_value(d->free_antistokes);
-        p_quantity_set_value_no_notify(d->pump,
-            1.0 / (1.0 / stokes + raman));
-        p_quantity_set_value_no_notify(d->probe,
-            1.0 / (1.0 / antistokes - raman));
-    } else {
-        error_locked(d->free_raman);
+    guint node;
+    for(node = 0; node < NUM_NODES; node++)
+        if(node_quantity(d, node) == quantity)
+            break;
+    g_return_if_fail(node < NUM_NODES);
+
+    gboolean ok = p_graph_set_value(d->graph, node, value);
+    if(ok)
+        journal_add(d, P_JOURNAL_VALUE, node, value);
+    if(node < FREE_NODE(0)) {
+        update_tuning(d);
         return;
     }
-    set_consistent();
+    if(ok)
+        set_consistent(d);
+    else
+        error_locked(d, node);
 }
 
 void G_MODULE_EXPORT
-on_beam_combination_changed(GtkComboBox *combobox)
+on_beam_combination_changed(GtkComboBox *combobox, struct Data *d)
 {
     d->mode = gtk_combo_box_get_active(combobox);
+    journal_add(d, P_JOURNAL_MODE, 0, d->mode);
+    p_graph_touch(d->graph, OPO_NODE(CARS_OPO_SIGNAL));
+    update_tuning(d);
 }
 
 void G_MODULE_EXPORT
-on_beam_units_changed(GtkComboBox *combobox)
+on_beam_units_changed(GtkComboBox *combobox, struct Data *d)
 {
+    int i;
     d->display = gtk_combo_box_get_active(combobox);
-    p_quantity_set_unit(d->signal, d->display);
-    p_quantity_set_unit(d->antistokes, d->display);
-    p_quantity_set_unit(d->pump, d->display);
-    p_quantity_set_unit(d->stokes, d->display);
-    p_quantity_set_unit(d->probe, d->display);
-    p_quantity_set_unit(d->free_antistokes, d->display);
+    p_quantity_set_unit(d->opo[CARS_OPO_SIGNAL], d->display);
+    p_quantity_set_unit(d->opo[CARS_OPO_ANTISTOKES], d->display);
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++)
+        if(i != CARS_RAMAN)
+            p_quantity_set_unit(d->free[i], d->display);
 }
 
 void G_MODULE_EXPORT
-on_energy_units_changed(GtkComboBox *combobox)
+on_energy_units_changed(GtkComboBox *combobox, struct Data *d)
 {
     d->units = gtk_combo_box_get_active(combobox);
-    p_quantity_set_unit(d->raman, d->units);
-    p_quantity_set_unit(d->free_raman, d->units);
+    p_quantity_set_unit(d->opo[CARS_OPO_RAMAN], d->units);
+    p_quantity_set_unit(d->free[CARS_RAMAN], d->units);
 }
 
 void G_MODULE_EXPORT
-on_degenerate_toggled(GtkToggleButton *togglebutton)
+on_degenerate_toggled(GtkToggleButton *togglebutton, struct Data *d)
 {
     d->degenerate = gtk_toggle_button_get_active(togglebutton);
-    if(d->degenerate) {
-        p_quantity_set_value(d->probe, p_quantity_get_value(d->pump));
-        g_signal_handler_unblock(d->pump, d->link_handler[0]);
-        g_signal_handler_unblock(d->probe, d->link_handler[1]);
-    } else {
-        g_signal_handler_block(d->pump, d->link_handler[0]);
-        g_signal_handler_block(d->probe, d->link_handler[1]);
-    }
+    journal_add(d, P_JOURNAL_DEGENERATE, 0, d->degenerate);
+    if(d->degenerate)
+        p_quantity_set_value(d->free[CARS_PROBE],
+            p_quantity_get_value(d->free[CARS_PUMP]));
+}
+
+static void
+on_lock_info_response(GtkInfoBar *info, gint response, struct Data *d)
+{
+    int i;
+    gtk_widget_hide(GTK_WIDGET(info));
+    if(response != GTK_RESPONSE_ACCEPT)
+        return;
+
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++)
+        if(d->release & CARS_LOCKED(i))
+            p_quantity_set_locked(d->free[i], FALSE);
+    /* Retry the edit that failed */
+    PQuantity *quantity = node_quantity(d, d->failed_node);
+    on_quantity_changed(quantity, p_quantity_get_value(quantity), d);
 }
 
 static void
-on_pump_probe_lock_changed(PQuantity *quantity)
+on_lock_changed(PQuantity *quantity, gboolean lock, struct Data *d)
+{
+    int i;
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++)
+        if(d->free[i] == quantity)
+            journal_add(d, P_JOURNAL_LOCK, i, lock);
+}
+
+static void
+on_pump_probe_lock_changed(PQuantity *quantity, gboolean lock, struct Data *d)
 {
     if(d->degenerate) {
-        gboolean lock = p_quantity_get_locked(quantity);
-        if(p_quantity_get_locked(d->pump) != lock)
-            p_quantity_set_locked(d->pump, lock);
-        if(p_quantity_get_locked(d->probe) != lock)
-            p_quantity_set_locked(d->probe, lock);
+        if(p_quantity_get_locked(d->free[CARS_PUMP]) != lock)
+            p_quantity_set_locked(d->free[CARS_PUMP], lock);
+        if(p_quantity_get_locked(d->free[CARS_PROBE]) != lock)
+            p_quantity_set_locked(d->free[CARS_PROBE], lock);
     }
 }
 
 static void
-on_pump_probe_changed(PQuantity *quantity, gdouble value,
-    PQuantity *other_quantity)
+panel_free(struct Data *d)
 {
-    p_quantity_set_value_no_notify(other_quantity, value);
+    int i;
+    for(i = 0; i < CARS_NUM_OPO_QUANTITIES; i++)
+        g_object_unref(d->opo[i]);
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++)
+        g_object_unref(d->free[i]);
+    p_graph_free(d->graph);
+    g_slice_free(struct Data, d);
 }
 
-static void
-create_main_window(void)
+static struct Data *
+panel_new(void)
 {
     GError *error = NULL;
     GtkBuilder *builder = gtk_builder_new();
+    struct Data *d = g_slice_new0(struct Data);
 
     /* Build interface */
-    gtk_builder_add_from_string(builder, interface_string, -1, &error);
-    HANDLE_ERROR("Could not build interface", error);
+    gtk_builder_add_objects_from_string(builder, interface_string, -1,
+        panel_objects, &error);
+    HANDLE_ERROR("Could not build panel", error);
 
     /* Get pointers to widgets */
-    d->main_window = GTK_WIDGET(gtk_builder_get_object(builder, "main_window"));
+    d->panel = GTK_WIDGET(gtk_builder_get_object(builder, "panel"));
     d->beam_combination =
         GTK_WIDGET(gtk_builder_get_object(builder, "beam_combination"));
     d->beam_units =
         GTK_WIDGET(gtk_builder_get_object(builder, "beam_units"));
     d->energy_units =
         GTK_WIDGET(gtk_builder_get_object(builder, "energy_units"));
+    d->signal_tuning =
+        GTK_WIDGET(gtk_builder_get_object(builder, "signal_tuning"));
+    d->antistokes_tuning =
+        GTK_WIDGET(gtk_builder_get_object(builder, "antistokes_tuning"));
 
     /* Calculate initial values */
     gdouble raman = 300000.0;
-    gdouble invpump = 1.0 / PUMP_WAVELENGTH;
+    gdouble invpump = 1.0 / CARS_PUMP_WAVELENGTH;
     gdouble pumpprobe = 2.0 / (raman + invpump);
     gdouble stokes = 1.0 / (invpump - 1.0 / pumpprobe);
     gdouble antistokes = 1.0 / (3.0 / pumpprobe - invpump);
 
     /* Set up quantity displays */
-    d->raman = p_quantity_new(
+    d->opo[CARS_OPO_RAMAN] = p_quantity_new(
         GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "raman_shift")),
         GTK_LABEL(gtk_builder_get_object(builder, "raman_shift_unit")), NULL,
-        raman, 0.0, 1018900.0, NUM_ENERGY_UNITS, energy_units);
-    d->signal = p_quantity_new(
+        raman, 0.0, 1018900.0, CARS_NUM_ENERGY_UNITS, energy_units);
+    d->opo[CARS_OPO_SIGNAL] = p_quantity_new(
         GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "signal")),
         GTK_LABEL(gtk_builder_get_object(builder, "signal_unit")), NULL,
-        pumpprobe, 690.0e-9, 1064.1e-9, NUM_BEAM_UNITS, beam_units);
-    d->antistokes = p_quantity_new(
+        pumpprobe, CARS_SIGNAL_MIN, CARS_SIGNAL_MAX, CARS_NUM_BEAM_UNITS,
+        beam_units);
+    d->opo[CARS_OPO_ANTISTOKES] = p_quantity_new(
         GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "antistokes")),
         GTK_LABEL(gtk_builder_get_object(builder, "antistokes_unit")), NULL,
-        antistokes, 405.1e-9, 1064.1e-9, NUM_BEAM_UNITS, beam_units);
-    d->pump = p_quantity_new(
+        antistokes, CARS_ANTISTOKES_MIN, CARS_ANTISTOKES_MAX,
+        CARS_NUM_BEAM_UNITS, beam_units);
+    d->free[CARS_PUMP] = p_quantity_new(
         GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "pump")),
         GTK_LABEL(gtk_builder_get_object(builder, "pump_unit")),
         GTK_TOGGLE_BUTTON(gtk_builder_get_object(builder, "pump_lock")),
-        pumpprobe, 0.0, 2000.0e-9, NUM_BEAM_UNITS, beam_units);
-    d->stokes = p_quantity_new(
+        pumpprobe, 0.0, 2000.0e-9, CARS_NUM_BEAM_UNITS, beam_units);
+    d->free[CARS_STOKES] = p_quantity_new(
         GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "stokes")),
         GTK_LABEL(gtk_builder_get_object(builder, "stokes_unit")),
         GTK_TOGGLE_BUTTON(gtk_builder_get_object(builder, "stokes_lock")),
-        stokes, 0.0, 2000.0e-9, NUM_BEAM_UNITS, beam_units);
-    d->probe = p_quantity_new(
+        stokes, 0.0, 2000.0e-9, CARS_NUM_BEAM_UNITS, beam_units);
+    d->free[CARS_PROBE] = p_quantity_new(
         GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "probe")),
         GTK_LABEL(gtk_builder_get_object(builder, "probe_unit")),
         GTK_TOGGLE_BUTTON(gtk_builder_get_object(builder, "probe_lock")),
-        pumpprobe, 0.0, 2000.0e-9, NUM_BEAM_UNITS, beam_units);
-    d->free_antistokes = p_quantity_new(
+        pumpprobe, 0.0, 2000.0e-9, CARS_NUM_BEAM_UNITS, beam_units);
+    d->free[CARS_ANTISTOKES] = p_quantity_new(
         GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "free_antistokes")),
         GTK_LABEL(gtk_builder_get_object(builder, "free_antistokes_unit")),
         GTK_TOGGLE_BUTTON(gtk_builder_get_object(builder, "antistokes_lock")),
-        antistokes, 0.0, 4000.0e-9, NUM_BEAM_UNITS, beam_units);
-    d->free_raman = p_quantity_new(
+        antistokes, 0.0, 4000.0e-9, CARS_NUM_BEAM_UNITS, beam_units);
+    d->free[CARS_RAMAN] = p_quantity_new(
         GTK_SPIN_BUTTON(gtk_builder_get_object(builder, "free_raman_shift")),
         GTK_LABEL(gtk_builder_get_object(builder, "free_raman_shift_unit")),
         GTK_TOGGLE_BUTTON(gtk_builder_get_object(builder, "raman_shift_lock")),
-        raman, 0.0, 500000.0, NUM_ENERGY_UNITS, energy_units);
+        raman, 0.0, 500000.0, CARS_NUM_ENERGY_UNITS, energy_units);
 
     /* Build combo box menu for Raman shift units; can't do this automatically,
     because we have a custom renderer that uses the "markup" property instead
@@ -544,7 +463,7 @@ create_main_window(void)
     GtkListStore *store = gtk_list_store_new(1, G_TYPE_STRING);
     GtkTreeIter iter;
     int i;
-    for(i = 0; i < NUM_ENERGY_UNITS; i++) {
+    for(i = 0; i < CARS_NUM_ENERGY_UNITS; i++) {
         gtk_list_store_append(store, &iter);
         gtk_list_store_set(store, &iter, 0, energy_units[i].display_name, -1);
     }
@@ -562,59 +481,150 @@ create_main_window(void)
     gtk_combo_box_set_active(GTK_COMBO_BOX(d->beam_units), 0);
     gtk_combo_box_set_active(GTK_COMBO_BOX(d->energy_units), 0);
 
-    /* Connect signals */
-    gtk_builder_connect_signals(builder, NULL);
+    /* Build the dependency graph. The signal depends on the other OPO
+    quantities and they depend on it, so the two relations form a cycle that
+    the graph runs in the order they are added. Which free beams an edit
+    recalculates depends on the locks, so each free beam has a relation that
+    may write all the others. */
+    d->graph = p_graph_new(NUM_NODES, (PGraphNotify)on_node_changed, d);
+    p_graph_add_relation(d->graph, P_GRAPH_ON_EDIT,
+        P_GRAPH_NODE(OPO_NODE(CARS_OPO_RAMAN)) |
+        P_GRAPH_NODE(OPO_NODE(CARS_OPO_ANTISTOKES)),
+        P_GRAPH_NODE(OPO_NODE(CARS_OPO_SIGNAL)), solve_signal, d);
+    p_graph_add_relation(d->graph, P_GRAPH_ON_CHANGE,
+        P_GRAPH_NODE(OPO_NODE(CARS_OPO_SIGNAL)),
+        P_GRAPH_NODE(OPO_NODE(CARS_OPO_RAMAN)) |
+        P_GRAPH_NODE(OPO_NODE(CARS_OPO_ANTISTOKES)), solve_from_signal, d);
+    guint64 free_nodes = 0;
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++)
+        free_nodes |= P_GRAPH_NODE(FREE_NODE(i));
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++) {
+        guint64 edited = P_GRAPH_NODE(FREE_NODE(i));
+        p_graph_add_relation(d->graph, P_GRAPH_ON_EDIT, edited,
+            free_nodes & ~edited, solve_free, d);
+    }
+    guint node;
+    for(node = 0; node < NUM_NODES; node++)
+        p_graph_init_value(d->graph, node,
+            p_quantity_get_value(node_quantity(d, node)));
+
+    /* Lock conflicts are reported above the calculator */
+    d->lock_info = gtk_info_bar_new_with_buttons("_Unlock",
+        GTK_RESPONSE_ACCEPT, "_Close", GTK_RESPONSE_CLOSE, NULL);
+    gtk_info_bar_set_message_type(GTK_INFO_BAR(d->lock_info),
+        GTK_MESSAGE_WARNING);
+    /* Named so that input traces can record and replay its responses */
+    gtk_buildable_set_name(GTK_BUILDABLE(d->lock_info), "lock_info");
+    d->lock_message = gtk_label_new(NULL);
+    gtk_label_set_line_wrap(GTK_LABEL(d->lock_message), TRUE);
+    gtk_widget_show(d->lock_message);
+    gtk_container_add(GTK_CONTAINER(gtk_info_bar_get_content_area(
+        GTK_INFO_BAR(d->lock_info))), d->lock_message);
+    gtk_widget_set_no_show_all(d->lock_info, TRUE);
+    gtk_box_pack_start(GTK_BOX(d->panel), d->lock_info, FALSE, FALSE, 0);
+    gtk_box_reorder_child(GTK_BOX(d->panel), d->lock_info, 0);
+    g_signal_connect(d->lock_info, "response",
+        G_CALLBACK(on_lock_info_response), d);
+
+    if(tuning_table != NULL) {
+        gtk_widget_show(d->signal_tuning);
+        gtk_widget_show(d->antistokes_tuning);
+        update_tuning(d);
+    }
+
+    /* Connect signals; the builder holds the only reference to the panel
+    until the caller adds it to the notebook */
+    gtk_builder_connect_signals(builder, d);
+    g_object_ref_sink(d->panel);
     g_object_unref(builder);
-    g_signal_connect(d->beam_combination, "changed",
-        G_CALLBACK(calculate_opo_from_signal), NULL);
-    g_signal_connect_after(d->raman, "changed",
-        G_CALLBACK(calculate_opo_from_raman), NULL);
-    g_signal_connect_after(d->signal, "changed",
-        G_CALLBACK(calculate_opo_from_signal), NULL);
-    g_signal_connect_after(d->antistokes, "changed",
-        G_CALLBACK(calculate_opo_from_antistokes), NULL);
-    g_signal_connect_after(d->pump, "changed",
-        G_CALLBACK(calculate_free_from_pump), NULL);
-    g_signal_connect_after(d->stokes, "changed",
-        G_CALLBACK(calculate_free_from_stokes), NULL);
-    g_signal_connect_after(d->probe, "changed",
-        G_CALLBACK(calculate_free_from_probe), NULL);
-    g_signal_connect_after(d->free_antistokes, "changed",
-        G_CALLBACK(calculate_free_from_antistokes), NULL);
-    g_signal_connect_after(d->free_raman, "changed",
-        G_CALLBACK(calculate_free_from_raman), NULL);
-    g_signal_connect(d->pump, "lock-changed",
-        G_CALLBACK(on_pump_probe_lock_changed), NULL);
-    g_signal_connect(d->probe, "lock-changed",
-        G_CALLBACK(on_pump_probe_lock_changed), NULL);
-    d->link_handler[0] = g_signal_connect(d->pump, "changed",
-        G_CALLBACK(on_pump_probe_changed), d->probe);
-    d->link_handler[1] = g_signal_connect(d->probe, "changed",
-        G_CALLBACK(on_pump_probe_changed), d->pump);
+    for(node = 0; node < NUM_NODES; node++)
+        g_signal_connect_after(node_quantity(d, node), "changed",
+            G_CALLBACK(on_quantity_changed), d);
+    for(i = 0; i < CARS_NUM_FREE_QUANTITIES; i++)
+        g_signal_connect(d->free[i], "lock-changed",
+            G_CALLBACK(on_lock_changed), d);
+    g_signal_connect(d->free[CARS_PUMP], "lock-changed",
+        G_CALLBACK(on_pump_probe_lock_changed), d);
+    g_signal_connect(d->free[CARS_PROBE], "lock-changed",
+        G_CALLBACK(on_pump_probe_lock_changed), d);
 
     /* Initialize state */
-    d->units = WAVENUMBERS;
-    d->display = WAVELENGTHS;
-    d->mode = SIGNAL_IDLER;
+    d->units = CARS_WAVENUMBERS;
+    d->display = CARS_WAVELENGTHS;
+    d->mode = CARS_SIGNAL_IDLER;
     d->degenerate = TRUE;
+
+    /* The panel widget owns its state */
+    g_object_set_data_full(G_OBJECT(d->panel), "panel-data", d,
+        (GDestroyNotify)panel_free);
+    return d;
 }
 
-static void
-data_free(void)
+static GtkWidget *
+create_main_window(void)
 {
-    g_object_unref(d->raman);
-    g_object_unref(d->signal);
-    g_object_unref(d->antistokes);
-    g_slice_free(struct Data, d);
+    GError *error = NULL;
+    GtkBuilder *builder = gtk_builder_new();
+    gchar *window_objects[] = { "main_window", "about_window", NULL };
+
+    gtk_builder_add_objects_from_string(builder, interface_string, -1,
+        window_objects, &error);
+    HANDLE_ERROR("Could not build interface", error);
+
+    GtkWidget *main_window =
+        GTK_WIDGET(gtk_builder_get_object(builder, "main_window"));
+    GtkNotebook *panels =
+        GTK_NOTEBOOK(gtk_builder_get_object(builder, "panels"));
+    gtk_builder_connect_signals(builder, NULL);
+    /* Closing the window destroys it before the main loop quits */
+    g_object_ref(main_window);
+    g_object_unref(builder);
+
+    int i;
+    for(i = 0; i < num_panels; i++) {
+        struct Data *d = panel_new();
+        gchar *title = g_strdup_printf("Laser %d", i + 1);
+        gtk_notebook_append_page(panels, d->panel, gtk_label_new(title));
+        g_object_unref(d->panel);
+        g_object_set_data(G_OBJECT(d->panel), "panel-number",
+            GINT_TO_POINTER(i + 1));
+        g_free(title);
+        d->number = i + 1;
+        journal_add_panel(d);
+    }
+    gtk_notebook_set_show_tabs(panels, num_panels > 1);
+    gtk_notebook_set_show_border(panels, num_panels > 1);
+
+    return main_window;
 }
 
 int
 main(int argc, char *argv[])
 {
+    GError *error = NULL;
+
     /* Initialize GTK+ */
-    gtk_init(&argc, &argv);
+    if(!gtk_init_with_args(&argc, &argv, NULL, options, NULL, &error)) {
+        g_printerr("%s\n", error? error->message : "Cannot open display");
+        return 1;
+    }
+    num_panels = MAX(num_panels, 1);
+    if(tuning_table_file != NULL) {
+        tuning_table = cars_tuning_table_load(tuning_table_file);
+        if(tuning_table == NULL) {
+            g_printerr("Cannot read tuning table %s\n", tuning_table_file);
+            return 1;
+        }
+    }
+    if(journal_file != NULL) {
+        journal = p_journal_open(journal_file, &error);
+        if(journal == NULL) {
+            g_printerr("%s\n", error->message);
+            return 1;
+        }
+    }
 
-    /* Load icons */
+    /* Load icons, shared by all panels */
     GdkPixbuf *oslogo =
         gdk_pixbuf_new_from_inline(-1, oslogo_data, FALSE, NULL);
     GdkPixbuf *oslogo_16 =
@@ -624,15 +634,42 @@ main(int argc, char *argv[])
     g_object_unref(oslogo);
     g_object_unref(oslogo_16);
 
-    d = g_slice_new0(struct Data);
-
     /* Create the main window */
-    create_main_window();
+    GtkWidget *main_window = create_main_window();
+
+    /* Record or replay user input */
+    PReplay *replay = NULL;
+    if(record_file != NULL || replay_file != NULL)
+        replay = p_replay_new(main_window);
+    if((record_file != NULL &&
+        !p_replay_record(replay, record_file, &error)) ||
+        (replay_file != NULL &&
+        !p_replay_play(replay, replay_file, replay_speed, &error))) {
+        g_printerr("%s\n", error->message);
+        return 1;
+    }
 
     /* Enter the main loop */
-    gtk_widget_show_all(d->main_window);
+    gtk_widget_show_all(main_window);
     gtk_main();
 
-    data_free();
-    return 0;
+    int status = 0;
+    if(replay_file != NULL) {
+        gdouble latency = p_replay_report(replay, stdout);
+        if(max_latency > 0.0 && latency > max_latency) {
+            g_printerr("Frame latency %.2f ms (99th percentile) exceeds "
+                "%.2f ms\n", latency, max_latency);
+            status = 1;
+        }
+    }
+    if(replay)
+        p_replay_free(replay);
+    gtk_widget_destroy(main_window);
+    g_object_unref(main_window);
+    cars_tuning_table_free(tuning_table);
+    if(journal && !p_journal_close(journal, &error)) {
+        g_printerr("%s\n", error->message);
+        status = 1;
+    }
+    return status;
 }
@@ -0,0 +1,383 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "cars.h"
+
+#define NUM_CANDIDATES 8
+#define MAX_SEGMENT 3
+#define MAX_PASSES 50
+
+/* The sweep is a path that starts at the current OPO setting. It is stored as
+a cycle through a depot node 0, which stands for the starting setting, and
+nodes 1..n for the bands; returning to the depot is free, so the path can end
+anywhere. Asymmetric costs are allowed, so the local search only moves
+segments around and never reverses them. */
+struct Plan {
+    size_t num_nodes;
+    const CarsSweepCost *cost;
+    int free_start;
+
+    int *mode; /* per node; the depot holds the starting setting */
+    double *signal;
+    const double *feasible; /* n rows of CARS_NUM_BEAM_COMBINATIONS signals */
+    size_t *next;
+    size_t *prev;
+};
+
+struct SortKey {
+    double signal;
+    size_t node;
+};
+
+static double
+edge_cost(const CarsSweepCost *cost, int from_mode, double from_signal,
+    int to_mode, double to_signal)
+{
+    if(cost->func)
+        return cost->func(from_mode, from_signal, to_mode, to_signal,
+            cost->data);
+    return fabs(to_signal - from_signal) / cost->slew_rate +
+        (from_mode != to_mode? cost->mode_change_time : 0.0);
+}
+
+static double
+node_cost(const struct Plan *p, size_t u, size_t v)
+{
+    if(v == 0 || (u == 0 && p->free_start))
+        return 0.0;
+    return edge_cost(p->cost, p->mode[u], p->signal[u], p->mode[v],
+        p->signal[v]);
+}
+
+static int
+compare_keys(const void *a, const void *b)
+{
+    const struct SortKey *x = a, *y = b;
+    if(x->signal != y->signal)
+        return (x->signal > y->signal) - (x->signal < y->signal);
+    return (x->node > y->node) - (x->node < y->node);
+}
+
+/* Nodes a..b (following "next") are a segment that does not contain x */
+static int
+segment_contains(const struct Plan *p, size_t a, size_t b, size_t x)
+{
+    for(;; a = p->next[a]) {
+        if(a == x)
+            return 1;
+        if(a == b)
+            return 0;
+    }
+}
+
+/* Or-opt: move the segment a..b to between x and next[x] if that is cheaper */
+static int
+try_move(struct Plan *p, size_t a, size_t b, size_t x)
+{
+    size_t before = p->prev[a], after = p->next[b], y = p->next[x];
+    if(x == before || segment_contains(p, a, b, x))
+        return 0;
+    double removed = node_cost(p, before, a) + node_cost(p, b, after) -
+        node_cost(p, before, after);
+    double added = node_cost(p, x, a) + node_cost(p, b, y) -
+        node_cost(p, x, y);
+    if(!(added < removed - 1e-12 * fabs(removed)))
+        return 0;
+
+    p->next[before] = after;
+    p->prev[after] = before;
+    p->next[x] = a;
+    p->prev[a] = x;
+    p->next[b] = y;
+    p->prev[y] = b;
+    return 1;
+}
+
+static int
+improve_order(struct Plan *p, struct SortKey *keys, size_t *position)
+{
+    size_t n = p->num_nodes - 1, i, node;
+    int improved = 0;
+
+    /* Candidate neighbors are the nearest nodes in signal wavelength */
+    for(i = 0; i < n; i++) {
+        keys[i].signal = p->signal[i + 1];
+        keys[i].node = i + 1;
+    }
+    qsort(keys, n, sizeof(struct SortKey), compare_keys);
+    for(i = 0; i < n; i++)
+        position[keys[i].node] = i;
+
+    for(node = 1; node <= n; node++) {
+        size_t a = node, b = node;
+        int length;
+        for(length = 1; length <= MAX_SEGMENT; length++) {
+            size_t pos = position[a];
+            size_t lo = pos > NUM_CANDIDATES / 2? pos - NUM_CANDIDATES / 2 : 0;
+            size_t hi = pos + NUM_CANDIDATES / 2 < n?
+                pos + NUM_CANDIDATES / 2 : n - 1;
+            int moved = 0;
+            for(i = lo; i <= hi && !moved; i++) {
+                size_t c = keys[i].node;
+                if(c == a)
+                    continue;
+                /* Insert either after or before the candidate */
+                moved = try_move(p, a, b, c) || try_move(p, a, b, p->prev[c]);
+            }
+            if(moved) {
+                improved = 1;
+                break;
+            }
+            b = p->next[b];
+            if(b == 0)
+                break;
+        }
+    }
+    return improved;
+}
+
+/* Switch bands to another feasible beam combination if that makes the
+transitions to and from them cheaper */
+static int
+improve_modes(struct Plan *p)
+{
+    int improved = 0, mode;
+    size_t node;
+    for(node = 1; node < p->num_nodes; node++) {
+        const double *signals = p->feasible + (node - 1) *
+            CARS_NUM_BEAM_COMBINATIONS;
+        size_t before = p->prev[node], after = p->next[node];
+        double best = node_cost(p, before, node) + node_cost(p, node, after);
+        int best_mode = p->mode[node];
+        double best_signal = p->signal[node];
+        for(mode = 0; mode < CARS_NUM_BEAM_COMBINATIONS; mode++) {
+            if(mode == best_mode || isnan(signals[mode]))
+                continue;
+            int old_mode = p->mode[node];
+            double old_signal = p->signal[node];
+            p->mode[node] = mode;
+            p->signal[node] = signals[mode];
+            double cost = node_cost(p, before, node) +
+                node_cost(p, node, after);
+            p->mode[node] = old_mode;
+            p->signal[node] = old_signal;
+            if(cost < best - 1e-12 * fabs(best)) {
+                best = cost;
+                best_mode = mode;
+                best_signal = signals[mode];
+            }
+        }
+        if(best_mode != p->mode[node]) {
+            p->mode[node] = best_mode;
+            p->signal[node] = best_signal;
+            improved = 1;
+        }
+    }
+    return improved;
+}
+
+/* The k-th ordering of the beam combinations, in lexicographic order */
+static void
+nth_permutation(int *rank, unsigned k)
+{
+    unsigned factorial = 1;
+    int m, r;
+    for(m = 0; m < CARS_NUM_BEAM_COMBINATIONS; m++) {
+        rank[m] = m;
+        if(m > 0)
+            factorial *= m;
+    }
+    for(m = 0; m < CARS_NUM_BEAM_COMBINATIONS - 1; m++) {
+        int chosen = rank[m + k / factorial];
+        for(r = m + k / factorial; r > m; r--)
+            rank[r] = rank[r - 1];
+        rank[m] = chosen;
+        k %= factorial;
+        factorial /= CARS_NUM_BEAM_COMBINATIONS - 1 - m;
+    }
+}
+
+/* Serpentine sweeps: each band gets the first beam combination in "rank" that
+reaches it, and the groups are swept through their signal wavelengths in that
+order, each towards its far end. Returns the total cost. */
+static double
+initial_tour(struct Plan *p, struct SortKey *keys, const int *rank)
+{
+    size_t n = p->num_nodes - 1, i, count = 0, last = 0;
+    double here = p->signal[0], total = 0.0;
+    int r;
+
+    for(i = 1; i <= n; i++) {
+        const double *signals = p->feasible + (i - 1) *
+            CARS_NUM_BEAM_COMBINATIONS;
+        for(r = 0; isnan(signals[rank[r]]); r++)
+            ;
+        p->mode[i] = rank[r];
+        p->signal[i] = signals[rank[r]];
+    }
+
+    for(r = 0; r < CARS_NUM_BEAM_COMBINATIONS; r++) {
+        size_t first = count, k;
+        for(i = 1; i <= n; i++)
+            if(p->mode[i] == rank[r]) {
+                keys[count].signal = p->signal[i];
+                keys[count++].node = i;
+            }
+        if(count == first)
+            continue;
+        qsort(keys + first, count - first, sizeof(struct SortKey),
+            compare_keys);
+        int descending = !(p->free_start && first == 0) &&
+            fabs(keys[count - 1].signal - here) <
+            fabs(keys[first].signal - here);
+        for(k = 0; k < count - first; k++) {
+            size_t node = keys[descending? count - 1 - k : first + k].node;
+            total += node_cost(p, last, node);
+            p->next[last] = node;
+            p->prev[node] = last;
+            last = node;
+        }
+        here = p->signal[last];
+    }
+    p->next[last] = 0;
+    p->prev[0] = last;
+    return total;
+}
+
+CarsStatus
+cars_sweep_plan(const double *raman, size_t n, const CarsSweepCost *cost,
+    int start_mode, double start_signal, size_t *order, int *modes,
+    double *signals, size_t *num_planned, double *total_cost)
+{
+    size_t i, planned = 0, node;
+    int m;
+
+    if(cost == NULL || (cost->func == NULL && !(cost->slew_rate > 0.0)) ||
+        start_mode >= CARS_NUM_BEAM_COMBINATIONS)
+        return CARS_ERROR_INVALID;
+    if(n == 0) {
+        if(num_planned)
+            *num_planned = 0;
+        if(total_cost)
+            *total_cost = 0.0;
+        return CARS_OK;
+    }
+
+    double *feasible = malloc(n * CARS_NUM_BEAM_COMBINATIONS * sizeof(double));
+    double *work = malloc(3 * n * sizeof(double));
+    if(feasible == NULL || work == NULL) {
+        free(feasible);
+        free(work);
+        return CARS_ERROR_INVALID;
+    }
+
+    /* The settings that reach each band within the tuning ranges */
+    double *shift = work, *signal = work + n, *antistokes = work + 2 * n;
+    for(m = 0; m < CARS_NUM_BEAM_COMBINATIONS; m++) {
+        for(i = 0; i < n; i++)
+            shift[i] = raman[i];
+        cars_opo_solve(m, CARS_OPO_RAMAN, signal, shift, antistokes, n);
+        for(i = 0; i < n; i++) {
+            int ok = raman[i] >= 0.0 &&
+                signal[i] >= CARS_SIGNAL_MIN && signal[i] <= CARS_SIGNAL_MAX &&
+                antistokes[i] >= CARS_ANTISTOKES_MIN &&
+                antistokes[i] <= CARS_ANTISTOKES_MAX;
+            feasible[i * CARS_NUM_BEAM_COMBINATIONS + m] = ok? signal[i] : NAN;
+        }
+    }
+
+    /* Only the reachable bands take part in the sweep */
+    size_t *band = malloc((n + 1) * sizeof(size_t));
+    for(i = 0; band != NULL && i < n; i++)
+        for(m = 0; m < CARS_NUM_BEAM_COMBINATIONS; m++)
+            if(!isnan(feasible[i * CARS_NUM_BEAM_COMBINATIONS + m])) {
+                band[++planned] = i;
+                break;
+            }
+
+    struct Plan p;
+    p.num_nodes = planned + 1;
+    p.cost = cost;
+    p.free_start = start_mode < 0;
+    p.mode = malloc(p.num_nodes * sizeof(int));
+    p.signal = malloc(p.num_nodes * sizeof(double));
+    p.next = malloc(p.num_nodes * sizeof(size_t));
+    p.prev = malloc(p.num_nodes * sizeof(size_t));
+    struct SortKey *keys = malloc(p.num_nodes * sizeof(struct SortKey));
+    size_t *position = malloc(p.num_nodes * sizeof(size_t));
+    CarsStatus status = CARS_ERROR_INVALID;
+    if(band == NULL || !p.mode || !p.signal || !p.next || !p.prev || !keys ||
+        !position)
+        goto out;
+
+    /* Compact the feasible settings to the reachable bands */
+    for(node = 1; node <= planned; node++)
+        for(m = 0; m < CARS_NUM_BEAM_COMBINATIONS; m++)
+            feasible[(node - 1) * CARS_NUM_BEAM_COMBINATIONS + m] =
+                feasible[band[node] * CARS_NUM_BEAM_COMBINATIONS + m];
+    p.feasible = feasible;
+    p.mode[0] = start_mode;
+    p.signal[0] = start_signal;
+
+    /* Local search only makes small changes, so start from the best order of
+    beam combinations */
+    int rank[CARS_NUM_BEAM_COMBINATIONS], best_rank = 0;
+    unsigned k, num_orders = 1;
+    double best = INFINITY;
+    for(m = 2; m <= CARS_NUM_BEAM_COMBINATIONS; m++)
+        num_orders *= m;
+    for(k = 0; k < num_orders; k++) {
+        nth_permutation(rank, k);
+        double total = initial_tour(&p, keys, rank);
+        if(total < best) {
+            best = total;
+            best_rank = k;
+        }
+    }
+    nth_permutation(rank, best_rank);
+    initial_tour(&p, keys, rank);
+
+    if(planned > 1) {
+        int pass;
+        for(pass = 0; pass < MAX_PASSES; pass++) {
+            int improved = improve_modes(&p);
+            improved |= improve_order(&p, keys, position);
+            if(!improved)
+                break;
+        }
+    }
+
+    /* Visit order, then the unreachable bands in their original order */
+    double total = 0.0;
+    size_t count = 0, u;
+    for(i = 0; i < n; i++) {
+        modes[i] = -1;
+        signals[i] = NAN;
+    }
+    for(u = 0, node = p.next[0]; node != 0; u = node, node = p.next[node]) {
+        total += node_cost(&p, u, node);
+        order[count++] = band[node];
+        modes[band[node]] = p.mode[node];
+        signals[band[node]] = p.signal[node];
+    }
+    for(i = 0; i < n; i++)
+        if(modes[i] < 0)
+            order[count++] = i;
+    if(num_planned)
+        *num_planned = planned;
+    if(total_cost)
+        *total_cost = total;
+    status = CARS_OK;
+
+out:
+    free(p.mode);
+    free(p.signal);
+    free(p.next);
+    free(p.prev);
+    free(keys);
+    free(position);
+    free(band);
+    free(feasible);
+    free(work);
+    return status;
+}
@@ -32,11 +32,8 @@ p_quantity_finalize(GObject *obj)
 {
     PQuantity *self = P_QUANTITY(obj);
     guint i;
-    for(i = 0; i < self->num_units; i++) {
-        g_free(self->unit_info[i]);
+    for(i = 0; i < self->num_units; i++)
         g_object_unref(self->adjustments[i]);
-    }
-    g_free(self->unit_info);
     g_free(self->adjustments);
 
     G_OBJECT_CLASS(p_quantity_parent_class)->finalize(obj);
@@ -59,7 +56,7 @@ p_quantity_class_init(PQuantityClass *klass)
 }
 
 static gdouble
-value_with_unit(gdouble value, PQuantityUnitInfo *unit)
+value_with_unit(gdouble value, const PQuantityUnitInfo *unit)
 {
     if(unit->inverse && value == 0)
         return G_MAXDOUBLE;
@@ -70,8 +67,8 @@ static void
 on_spin_button_changed(GtkSpinButton *button, PQuantity *quantity)
 {
     quantity->value = gtk_spin_button_get_value(button) /
-        quantity->unit_info[quantity->unit]->scale_factor;
-    if(quantity->unit_info[quantity->unit]->inverse)
+        quantity->unit_info[quantity->unit].scale_factor;
+    if(quantity->unit_info[quantity->unit].inverse)
         quantity->value = 1.0 / quantity->value;
     g_signal_emit_by_name(quantity, "changed", quantity->value);
 }
@@ -81,7 +78,7 @@ on_lock_toggled(GtkToggleButton *button, PQuantity *quantity)
 {
     quantity->locked = gtk_toggle_button_get_active(button);
     gtk_widget_set_sensitive(GTK_WIDGET(quantity->box), !quantity->locked);
-    g_signal_emit_by_name(quantity, "lock-changed");
+    g_signal_emit_by_name(quantity, "lock-changed", quantity->locked);
 }
 
 PQuantity *
@@ -97,22 +94,18 @@ p_quantity_new(GtkSpinButton *box, GtkLabel *label, GtkToggleButton *toggle,
     self->value = value;
     self->num_units = num_units;
 
-    self->unit_info = g_new0(PQuantityUnitInfo *, num_units);
+    /* The unit table is shared between all quantities that use it, so it must
+    outlive them; usually it is a static array */
+    self->unit_info = units;
     self->adjustments = g_new0(GtkAdjustment *, num_units);
     guint i;
     for(i = 0; i < self->num_units; i++) {
-        self->unit_info[i] = g_new0(PQuantityUnitInfo, 1);
-        self->unit_info[i]->display_name = g_strdup(units[i].display_name);
-        self->unit_info[i]->scale_factor = units[i].scale_factor;
-        self->unit_info[i]->inverse = units[i].inverse;
-        self->unit_info[i]->precision = units[i].precision;
-        self->unit_info[i]->step = units[i].step;
-        gdouble minconv = value_with_unit(min, self->unit_info[i]);
-        gdouble maxconv = value_with_unit(max, self->unit_info[i]);
+        gdouble minconv = value_with_unit(min, units + i);
+        gdouble maxconv = value_with_unit(max, units + i);
         self->adjustments[i] = GTK_ADJUSTMENT(
-            gtk_adjustment_new(value_with_unit(value, self->unit_info[i]),
+            gtk_adjustment_new(value_with_unit(value, units + i),
             MIN(minconv, maxconv), MAX(minconv, maxconv),
-            self->unit_info[i]->step, 10.0 * self->unit_info[i]->step, 0));
+            units[i].step, 10.0 * units[i].step, 0));
         g_object_ref_sink(self->adjustments[i]);
     }
 
@@ -132,13 +125,13 @@ p_quantity_set_unit(PQuantity *quantity, guint unit)
 {
     quantity->unit = unit;
     gtk_label_set_markup(quantity->label,
-        quantity->unit_info[unit]->display_name);
+        quantity->unit_info[unit].display_name);
     g_signal_handler_block(quantity->box, quantity->handler);
     gtk_spin_button_set_adjustment(quantity->box, quantity->adjustments[unit]);
     gtk_spin_button_set_digits(quantity->box,
-        quantity->unit_info[unit]->precision);
+        quantity->unit_info[unit].precision);
     gtk_spin_button_set_value(quantity->box,
-        value_with_unit(quantity->value, quantity->unit_info[unit]));
+        value_with_unit(quantity->value, quantity->unit_info + unit));
     g_signal_handler_unblock(quantity->box, quantity->handler);
 }
 
@@ -149,7 +142,7 @@ p_quantity_set_value(PQuantity *quantity, gdouble value)
 
     quantity->value = value;
     gtk_spin_button_set_value(quantity->box, value_with_unit(value,
-        quantity->unit_info[quantity->unit]));
+        quantity->unit_info + quantity->unit));
 }
 
 void
@@ -160,7 +153,7 @@ p_quantity_set_value_no_notify(PQuantity *quantity, gdouble value)
     quantity->value = value;
     g_signal_handler_block(quantity->box, quantity->handler);
     gtk_spin_button_set_value(quantity->box, value_with_unit(value,
-        quantity->unit_info[quantity->unit]));
+        quantity->unit_info + quantity->unit));
     g_signal_handler_unblock(quantity->box, quantity->handler);
 }
 
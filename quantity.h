@@ -30,7 +30,7 @@ struct _PQuantity {
     gdouble value;
     guint unit;
     guint num_units;
-    PQuantityUnitInfo **unit_info;
+    const PQuantityUnitInfo *unit_info; /* shared, not owned */
     GtkAdjustment **adjustments;
     guint handler;
     gdouble locked;
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Replay input traces on a virtual display and fail if the 99th percentile
+# latency from input to drawn frame is too high. Uses Xvfb if xvfb-run is
+# installed and a Broadway server otherwise, so it runs on any Linux box.
+#
+# Usage: replay-gate.sh [--max-latency=MS] TRACE...
+# Set CARS_WAVELENGTHS to the program to test; the default is the one in the
+# build directory.
+
+program=${CARS_WAVELENGTHS:-./cars-wavelengths}
+max_latency=50
+case "$1" in
+--max-latency=*)
+    max_latency=${1#--max-latency=}
+    shift ;;
+esac
+if [ $# -eq 0 ]; then
+    echo "Usage: $0 [--max-latency=MS] TRACE..." >&2
+    exit 2
+fi
+
+if command -v xvfb-run >/dev/null 2>&1; then
+    run() { xvfb-run -a -s "-screen 0 1280x1024x24" "$@"; }
+elif command -v broadwayd >/dev/null 2>&1; then
+    broadwayd :5 >/dev/null 2>&1 &
+    broadway=$!
+    trap 'kill $broadway' EXIT
+    sleep 1
+    run() { GDK_BACKEND=broadway BROADWAY_DISPLAY=:5 "$@"; }
+else
+    echo "$0: needs xvfb-run or broadwayd" >&2
+    exit 2
+fi
+
+status=0
+for trace in "$@"; do
+    echo "== $trace"
+    run "$program" --replay="$trace" --max-latency="$max_latency" || status=1
+done
+exit $status
@@ -0,0 +1,393 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include "quantity.h"
+#include "replay.h"
+
+/* Trace files are text, one action per line:
+    <milliseconds since start> <panel number> <widget name> <value>
+where the value is what the widget was set to: the displayed number for spin
+buttons, 0 or 1 for toggle buttons, the active row for combo boxes, and the
+response ID for the lock conflict bar ("lock_info"). */
+
+struct Action {
+    gdouble time;
+    guint panel;
+    gchar *name;
+    gdouble value;
+
+    /* measured */
+    guint emissions;
+    gdouble value_latency;
+    gdouble frame_latency;
+};
+
+enum {
+    SPIN_CHANGED,
+    TOGGLED,
+    COMBO_CHANGED,
+    INFO_BAR_RESPONSE,
+    QUANTITY_CHANGED,
+    LOCK_CHANGED,
+    NUM_HOOKS
+};
+
+struct _PReplay {
+    GtkWidget *window;
+    GHashTable *widgets; /* "panel/name" to widget */
+    guint signals[NUM_HOOKS];
+    gulong hooks[NUM_HOOKS];
+    guint emissions;
+
+    /* recording */
+    FILE *trace;
+    gint64 start;
+    GObject *action; /* widget of the last recorded action */
+
+    /* playback */
+    GArray *actions;
+    guint next;
+    gdouble speed;
+    gint64 applied;
+    gboolean waiting;
+    GdkFrameClock *clock;
+    gulong paint_handler;
+};
+
+static guint
+panel_number(GtkWidget *widget)
+{
+    for(; widget; widget = gtk_widget_get_parent(widget)) {
+        gpointer number = g_object_get_data(G_OBJECT(widget), "panel-number");
+        if(number)
+            return GPOINTER_TO_UINT(number);
+    }
+    return 0;
+}
+
+static void
+add_widgets(GtkWidget *widget, PReplay *self)
+{
+    const gchar *name = gtk_buildable_get_name(GTK_BUILDABLE(widget));
+    guint panel = panel_number(widget);
+    if(name && panel)
+        g_hash_table_insert(self->widgets,
+            g_strdup_printf("%u/%s", panel, name), widget);
+    if(GTK_IS_CONTAINER(widget))
+        gtk_container_forall(GTK_CONTAINER(widget),
+            (GtkCallback)add_widgets, self);
+}
+
+static GtkWidget *
+find_widget(PReplay *self, guint panel, const gchar *name)
+{
+    if(self->widgets == NULL) {
+        self->widgets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+            NULL);
+        add_widgets(self->window, self);
+    }
+    gchar *key = g_strdup_printf("%u/%s", panel, name);
+    GtkWidget *widget = g_hash_table_lookup(self->widgets, key);
+    g_free(key);
+    return widget;
+}
+
+static void
+record_action(PReplay *self, GtkWidget *widget, const GValue *params)
+{
+    const gchar *name = gtk_buildable_get_name(GTK_BUILDABLE(widget));
+    guint panel = panel_number(widget);
+    gdouble value;
+    gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+    if(name == NULL || panel == 0)
+        return;
+    if(GTK_IS_SPIN_BUTTON(widget))
+        value = gtk_spin_button_get_value(GTK_SPIN_BUTTON(widget));
+    else if(GTK_IS_TOGGLE_BUTTON(widget))
+        value = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget));
+    else if(GTK_IS_INFO_BAR(widget))
+        value = g_value_get_int(params + 1);
+    else
+        value = gtk_combo_box_get_active(GTK_COMBO_BOX(widget));
+
+    fprintf(self->trace, "%.1f %u %s %s\n",
+        (g_get_monotonic_time() - self->start) / 1000.0, panel, name,
+        g_ascii_dtostr(buffer, sizeof(buffer), value));
+    fflush(self->trace);
+
+    if(self->action)
+        g_object_remove_weak_pointer(self->action, (gpointer *)&self->action);
+    self->action = G_OBJECT(widget);
+    g_object_add_weak_pointer(self->action, (gpointer *)&self->action);
+}
+
+static gboolean
+on_emission(GSignalInvocationHint *hint, guint n_params,
+    const GValue *params, PReplay *self)
+{
+    self->emissions++;
+    /* Changes made by the handlers of a recorded action happen again when the
+    action is replayed, so only record changes that are not nested inside the
+    emission of the last recorded action. Emission hooks run after the
+    emission has started, so the action's own emission is still in progress
+    when this is called for one of its consequences. */
+    if(self->trace && hint->signal_id != self->signals[QUANTITY_CHANGED] &&
+        hint->signal_id != self->signals[LOCK_CHANGED] &&
+        (self->action == NULL ||
+        g_signal_get_invocation_hint(self->action) == NULL)) {
+        GObject *instance = g_value_get_object(params);
+        if(GTK_IS_WIDGET(instance))
+            record_action(self, GTK_WIDGET(instance), params);
+    }
+    return TRUE;
+}
+
+PReplay *
+p_replay_new(GtkWidget *window)
+{
+    PReplay *self = g_slice_new0(PReplay);
+    GType types[NUM_HOOKS] = {
+        GTK_TYPE_SPIN_BUTTON, GTK_TYPE_TOGGLE_BUTTON, GTK_TYPE_COMBO_BOX,
+        GTK_TYPE_INFO_BAR, P_TYPE_QUANTITY, P_TYPE_QUANTITY
+    };
+    const gchar *names[NUM_HOOKS] = {
+        "value-changed", "toggled", "changed", "response", "changed",
+        "lock-changed"
+    };
+    int i;
+
+    self->window = window;
+    for(i = 0; i < NUM_HOOKS; i++) {
+        /* The class must exist before its signals can be looked up */
+        gpointer klass = g_type_class_ref(types[i]);
+        self->signals[i] = g_signal_lookup(names[i], types[i]);
+        self->hooks[i] = g_signal_add_emission_hook(self->signals[i], 0,
+            (GSignalEmissionHook)on_emission, self, NULL);
+        g_type_class_unref(klass);
+    }
+    self->actions = g_array_new(FALSE, TRUE, sizeof(struct Action));
+    return self;
+}
+
+void
+p_replay_free(PReplay *replay)
+{
+    guint i;
+    for(i = 0; i < NUM_HOOKS; i++)
+        g_signal_remove_emission_hook(replay->signals[i], replay->hooks[i]);
+    if(replay->trace)
+        fclose(replay->trace);
+    if(replay->action)
+        g_object_remove_weak_pointer(replay->action,
+            (gpointer *)&replay->action);
+    if(replay->paint_handler)
+        g_signal_handler_disconnect(replay->clock, replay->paint_handler);
+    if(replay->widgets)
+        g_hash_table_unref(replay->widgets);
+    for(i = 0; i < replay->actions->len; i++)
+        g_free(g_array_index(replay->actions, struct Action, i).name);
+    g_array_free(replay->actions, TRUE);
+    g_slice_free(PReplay, replay);
+}
+
+gboolean
+p_replay_record(PReplay *replay, const gchar *filename, GError **error)
+{
+    replay->trace = g_fopen(filename, "w");
+    if(replay->trace == NULL) {
+        int saved_errno = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+            "Cannot write %s: %s", filename, g_strerror(saved_errno));
+        return FALSE;
+    }
+    fprintf(replay->trace, "# cars-wavelengths input trace\n");
+    replay->start = g_get_monotonic_time();
+    return TRUE;
+}
+
+static gboolean apply_next(PReplay *self);
+
+static void
+on_after_paint(GdkFrameClock *clock, PReplay *self)
+{
+    if(!self->waiting)
+        return;
+    self->waiting = FALSE;
+
+    struct Action *action = &g_array_index(self->actions, struct Action,
+        self->next);
+    action->frame_latency = (g_get_monotonic_time() - self->applied) / 1000.0;
+    if(++self->next == self->actions->len) {
+        gtk_main_quit();
+        return;
+    }
+
+    /* Keep the recorded pace, but never start before the previous action has
+    been drawn */
+    gdouble delay = 0.0;
+    if(self->speed > 0.0)
+        delay = (action[1].time - action[0].time) / self->speed -
+            action->frame_latency;
+    g_timeout_add(MAX(delay, 0.0), (GSourceFunc)apply_next, self);
+}
+
+static gboolean
+apply_next(PReplay *self)
+{
+    struct Action *action = &g_array_index(self->actions, struct Action,
+        self->next);
+    GtkWidget *widget = find_widget(self, action->panel, action->name);
+
+    if(self->paint_handler == 0) {
+        self->clock = gtk_widget_get_frame_clock(self->window);
+        self->paint_handler = g_signal_connect(self->clock, "after-paint",
+            G_CALLBACK(on_after_paint), self);
+    }
+
+    self->emissions = 0;
+    self->applied = g_get_monotonic_time();
+    if(widget == NULL)
+        g_warning("No widget %s in panel %u", action->name, action->panel);
+    else if(GTK_IS_SPIN_BUTTON(widget))
+        gtk_spin_button_set_value(GTK_SPIN_BUTTON(widget), action->value);
+    else if(GTK_IS_TOGGLE_BUTTON(widget))
+        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(widget),
+            action->value != 0.0);
+    else if(GTK_IS_COMBO_BOX(widget))
+        gtk_combo_box_set_active(GTK_COMBO_BOX(widget), (gint)action->value);
+    else if(GTK_IS_INFO_BAR(widget))
+        gtk_info_bar_response(GTK_INFO_BAR(widget), (gint)action->value);
+    /* The handlers run synchronously, so all quantities are final now */
+    action->value_latency = (g_get_monotonic_time() - self->applied) / 1000.0;
+    action->emissions = self->emissions;
+
+    self->waiting = TRUE;
+    gdk_frame_clock_request_phase(self->clock, GDK_FRAME_CLOCK_PHASE_PAINT);
+    return FALSE;
+}
+
+gboolean
+p_replay_play(PReplay *replay, const gchar *filename, gdouble speed,
+    GError **error)
+{
+    gchar *contents, **lines;
+    guint i;
+
+    if(!g_file_get_contents(filename, &contents, NULL, error))
+        return FALSE;
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    for(i = 0; lines[i]; i++) {
+        gchar **fields = g_strsplit_set(g_strstrip(lines[i]), " \t", -1);
+        struct Action action = { 0 };
+        gchar *end_time, *end_value;
+        if(fields[0][0] == '\0' || fields[0][0] == '#') {
+            g_strfreev(fields);
+            continue;
+        }
+        if(g_strv_length(fields) == 4) {
+            action.time = g_ascii_strtod(fields[0], &end_time);
+            action.panel = strtoul(fields[1], NULL, 10);
+            action.value = g_ascii_strtod(fields[3], &end_value);
+        }
+        if(g_strv_length(fields) != 4 || *end_time || *end_value ||
+            action.panel == 0) {
+            g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "%s:%u: invalid action", filename, i + 1);
+            g_strfreev(fields);
+            g_strfreev(lines);
+            return FALSE;
+        }
+        action.name = g_strdup(fields[2]);
+        g_array_append_val(replay->actions, action);
+        g_strfreev(fields);
+    }
+    g_strfreev(lines);
+
+    replay->speed = speed;
+    replay->next = 0;
+    if(replay->actions->len == 0)
+        g_idle_add((GSourceFunc)gtk_main_quit, NULL);
+    else
+        g_idle_add((GSourceFunc)apply_next, replay);
+    return TRUE;
+}
+
+static int
+compare_doubles(gconstpointer a, gconstpointer b)
+{
+    gdouble x = *(const gdouble *)a, y = *(const gdouble *)b;
+    return (x > y) - (x < y);
+}
+
+static gdouble
+percentile(GArray *sorted, gdouble p)
+{
+    if(sorted->len == 0)
+        return 0.0;
+    guint rank = (guint)ceil(p / 100.0 * sorted->len);
+    return g_array_index(sorted, gdouble, CLAMP(rank, 1, sorted->len) - 1);
+}
+
+static gdouble
+report_row(FILE *stream, const gchar *name, struct Action *actions,
+    guint count, const gchar *only)
+{
+    GArray *values = g_array_new(FALSE, FALSE, sizeof(gdouble));
+    GArray *frames = g_array_new(FALSE, FALSE, sizeof(gdouble));
+    guint i, emissions = 0;
+
+    for(i = 0; i < count; i++) {
+        if(only && strcmp(actions[i].name, only) != 0)
+            continue;
+        g_array_append_val(values, actions[i].value_latency);
+        g_array_append_val(frames, actions[i].frame_latency);
+        emissions += actions[i].emissions;
+    }
+    g_array_sort(values, compare_doubles);
+    g_array_sort(frames, compare_doubles);
+    fprintf(stream, "%-18s %6u %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.1f\n",
+        name, values->len, percentile(values, 50), percentile(values, 90),
+        percentile(values, 99), percentile(frames, 50), percentile(frames, 90),
+        percentile(frames, 99), values->len? (gdouble)emissions / values->len :
+        0.0);
+    gdouble result = percentile(frames, 99);
+    g_array_free(values, TRUE);
+    g_array_free(frames, TRUE);
+    return result;
+}
+
+/* Print latency percentiles in milliseconds, overall and per widget, with
+the mean number of signal emissions per action. Returns the 99th percentile
+of the latency until the next frame. */
+gdouble
+p_replay_report(PReplay *replay, FILE *stream)
+{
+    struct Action *actions = (struct Action *)replay->actions->data;
+    guint count = replay->next, i, j;
+    GPtrArray *names = g_ptr_array_new();
+
+    fprintf(stream, "%-18s %6s %8s %8s %8s %8s %8s %8s %8s\n", "action",
+        "count", "value50", "value90", "value99", "frame50", "frame90",
+        "frame99", "signals");
+    for(i = 0; i < count; i++) {
+        for(j = 0; j < names->len; j++)
+            if(strcmp(g_ptr_array_index(names, j), actions[i].name) == 0)
+                break;
+        if(j == names->len)
+            g_ptr_array_add(names, actions[i].name);
+    }
+    for(j = 0; j < names->len; j++) {
+        const gchar *name = g_ptr_array_index(names, j);
+        report_row(stream, name, actions, count, name);
+    }
+    g_ptr_array_free(names, TRUE);
+    return report_row(stream, "all", actions, count, NULL);
+}
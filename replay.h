@@ -0,0 +1,27 @@
+#ifndef __P_REPLAY_H__
+#define __P_REPLAY_H__
+
+#include <stdio.h>
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* Records user input on the calculator panels of a window to a trace file,
+and replays traces while measuring how long each action takes until all
+quantities are recomputed and until the next frame is drawn. Widgets are
+identified by panel number and by their name in interface.xml; panels are
+found through their "panel-number" data. */
+
+typedef struct _PReplay PReplay;
+
+PReplay *p_replay_new(GtkWidget *window);
+void p_replay_free(PReplay *replay);
+gboolean p_replay_record(PReplay *replay, const gchar *filename,
+    GError **error);
+gboolean p_replay_play(PReplay *replay, const gchar *filename, gdouble speed,
+    GError **error);
+gdouble p_replay_report(PReplay *replay, FILE *stream);
+
+G_END_DECLS
+
+#endif // __P_REPLAY_H__
@@ -0,0 +1,129 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "cars.h"
+
+/* Each output bin is a weighted sum of two neighbouring pixels. The weights
+include the linear interpolation and the Jacobian, so processing a frame is a
+pair of gathers and a multiply-add per bin, without branches. */
+struct _CarsResampler {
+    size_t num_pixels;
+    size_t num_bins;
+    double start;
+    double step;
+    int32_t *lower;
+    int32_t *upper;
+    double *lower_weight;
+    double *upper_weight;
+};
+
+CarsResampler *
+cars_resampler_new(size_t num_pixels, double start, double step,
+    size_t num_bins)
+{
+    if(num_pixels < 2 || num_pixels > INT32_MAX || num_bins == 0 ||
+        !(step > 0.0))
+        return NULL;
+
+    CarsResampler *self = calloc(1, sizeof(CarsResampler));
+    if(self == NULL)
+        return NULL;
+    self->num_pixels = num_pixels;
+    self->num_bins = num_bins;
+    self->start = start;
+    self->step = step;
+    self->lower = calloc(num_bins, sizeof(int32_t));
+    self->upper = calloc(num_bins, sizeof(int32_t));
+    self->lower_weight = calloc(num_bins, sizeof(double));
+    self->upper_weight = calloc(num_bins, sizeof(double));
+    if(!self->lower || !self->upper || !self->lower_weight ||
+        !self->upper_weight) {
+        cars_resampler_free(self);
+        return NULL;
+    }
+    return self;
+}
+
+void
+cars_resampler_free(CarsResampler *resampler)
+{
+    if(resampler == NULL)
+        return;
+    free(resampler->lower);
+    free(resampler->upper);
+    free(resampler->lower_weight);
+    free(resampler->upper_weight);
+    free(resampler);
+}
+
+/* Recompute the weights from the per-pixel Raman shifts and their Jacobian,
+as made by cars_calibration_raman_table(); does not allocate. The Raman axis
+must be strictly monotonic, in either direction. Bins outside of it are 0. */
+CarsStatus
+cars_resampler_set_axis(CarsResampler *resampler, const double *raman,
+    const double *jacobian)
+{
+    size_t n = resampler->num_pixels, k;
+    int descending = raman[n - 1] < raman[0];
+    size_t j = 0; /* position along the ascending axis */
+
+#define PIXEL(pos) (descending? n - 1 - (pos) : (pos))
+
+    for(k = 1; k < n; k++)
+        if(descending? !(raman[k] < raman[k - 1]) :
+            !(raman[k] > raman[k - 1]))
+            return CARS_ERROR_INVALID;
+
+    for(k = 0; k < resampler->num_bins; k++) {
+        double shift = resampler->start + k * resampler->step;
+        while(j + 2 < n && raman[PIXEL(j + 1)] <= shift)
+            j++;
+        size_t lo = PIXEL(j), hi = PIXEL(j + 1);
+        double t = (shift - raman[lo]) / (raman[hi] - raman[lo]);
+        resampler->lower[k] = lo;
+        resampler->upper[k] = hi;
+        if(t < 0.0 || t > 1.0) {
+            resampler->lower_weight[k] = 0.0;
+            resampler->upper_weight[k] = 0.0;
+            continue;
+        }
+        /* Counts per pixel to counts per unit of Raman shift */
+        resampler->lower_weight[k] = (1.0 - t) / fabs(jacobian[lo]);
+        resampler->upper_weight[k] = t / fabs(jacobian[hi]);
+    }
+
+#undef PIXEL
+    return CARS_OK;
+}
+
+void
+cars_resampler_process(const CarsResampler *resampler,
+    const double *restrict frame, double *restrict out)
+{
+    const int32_t *restrict lower = resampler->lower;
+    const int32_t *restrict upper = resampler->upper;
+    const double *restrict a = resampler->lower_weight;
+    const double *restrict b = resampler->upper_weight;
+    size_t k, n = resampler->num_bins;
+    for(k = 0; k < n; k++)
+        out[k] = a[k] * frame[lower[k]] + b[k] * frame[upper[k]];
+}
+
+void
+cars_resampler_process_u16(const CarsResampler *resampler,
+    const uint16_t *restrict frame, double *restrict out)
+{
+    const int32_t *restrict lower = resampler->lower;
+    const int32_t *restrict upper = resampler->upper;
+    const double *restrict a = resampler->lower_weight;
+    const double *restrict b = resampler->upper_weight;
+    size_t k, n = resampler->num_bins;
+    for(k = 0; k < n; k++)
+        out[k] = a[k] * frame[lower[k]] + b[k] * frame[upper[k]];
+}
+
+size_t
+cars_resampler_get_num_bins(const CarsResampler *resampler)
+{
+    return resampler->num_bins;
+}
@@ -0,0 +1,305 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cars.h"
+
+#define MAX_LINE 1024
+
+/* Rows sorted by channel and then signal wavelength, in separate arrays so
+that a lookup only touches the signal column until it has found its row */
+struct _CarsTuningTable {
+    size_t num_rows;
+    double *signal;
+    double *temperature;
+    double *cavity;
+
+    /* one entry per poling channel */
+    size_t num_channels;
+    int *channel;
+    size_t *first; /* row range of the channel */
+    size_t *count;
+    int *direction; /* of temperature against signal: 1, -1, or 0 if not
+                    monotonic, in which case there is no inverse lookup */
+};
+
+struct Row {
+    int channel;
+    double signal;
+    double temperature;
+    double cavity;
+};
+
+static int
+compare_rows(const void *a, const void *b)
+{
+    const struct Row *x = a, *y = b;
+    if(x->channel != y->channel)
+        return (x->channel > y->channel) - (x->channel < y->channel);
+    return (x->signal > y->signal) - (x->signal < y->signal);
+}
+
+void
+cars_tuning_table_free(CarsTuningTable *table)
+{
+    if(table == NULL)
+        return;
+    free(table->signal);
+    free(table->temperature);
+    free(table->cavity);
+    free(table->channel);
+    free(table->first);
+    free(table->count);
+    free(table->direction);
+    free(table);
+}
+
+CarsTuningTable *
+cars_tuning_table_new(const double *signal, const int *channel,
+    const double *temperature, const double *cavity, size_t n)
+{
+    size_t i, c;
+
+    if(n == 0)
+        return NULL;
+    struct Row *rows = malloc(n * sizeof(struct Row));
+    CarsTuningTable *self = calloc(1, sizeof(CarsTuningTable));
+    if(rows == NULL || self == NULL)
+        goto fail;
+    for(i = 0; i < n; i++) {
+        if(!(signal[i] > 0.0) || isnan(temperature[i]) || isnan(cavity[i]))
+            goto fail;
+        rows[i].channel = channel[i];
+        rows[i].signal = signal[i];
+        rows[i].temperature = temperature[i];
+        rows[i].cavity = cavity[i];
+    }
+    qsort(rows, n, sizeof(struct Row), compare_rows);
+
+    self->num_rows = n;
+    self->signal = malloc(n * sizeof(double));
+    self->temperature = malloc(n * sizeof(double));
+    self->cavity = malloc(n * sizeof(double));
+    for(i = 0, c = 0; i < n; i++)
+        if(i == 0 || rows[i].channel != rows[i - 1].channel)
+            c++;
+    self->num_channels = c;
+    self->channel = malloc(c * sizeof(int));
+    self->first = malloc(c * sizeof(size_t));
+    self->count = calloc(c, sizeof(size_t));
+    self->direction = malloc(c * sizeof(int));
+    if(!self->signal || !self->temperature || !self->cavity ||
+        !self->channel || !self->first || !self->count || !self->direction)
+        goto fail;
+
+    for(i = 0, c = 0; i < n; i++) {
+        if(i > 0 && rows[i].channel != rows[i - 1].channel)
+            c++;
+        else if(i > 0 && rows[i].signal == rows[i - 1].signal)
+            goto fail; /* two settings for one wavelength */
+        if(self->count[c]++ == 0) {
+            self->channel[c] = rows[i].channel;
+            self->first[c] = i;
+        }
+        self->signal[i] = rows[i].signal;
+        self->temperature[i] = rows[i].temperature;
+        self->cavity[i] = rows[i].cavity;
+    }
+
+    for(c = 0; c < self->num_channels; c++) {
+        const double *t = self->temperature + self->first[c];
+        int rising = 1, falling = 1;
+        for(i = 1; i < self->count[c]; i++) {
+            rising = rising && t[i] > t[i - 1];
+            falling = falling && t[i] < t[i - 1];
+        }
+        self->direction[c] = self->count[c] < 2? 0 : rising? 1 :
+            falling? -1 : 0;
+    }
+
+    free(rows);
+    return self;
+
+fail:
+    free(rows);
+    cars_tuning_table_free(self);
+    return NULL;
+}
+
+/* Vendor tables are text with one row per line: signal wavelength in nm,
+poling channel, crystal temperature in degrees Celsius and cavity length in
+mm, separated by commas, semicolons or white space. Lines whose first field
+is not a number, such as column headings, and lines starting with # are
+skipped. A line longer than MAX_LINE - 1 characters fails the load. */
+CarsTuningTable *
+cars_tuning_table_load(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    char line[MAX_LINE];
+    size_t n = 0, allocated = 0;
+    double *columns = NULL;
+    int *channels = NULL, ok = 1;
+
+    if(file == NULL)
+        return NULL;
+    while(ok && fgets(line, sizeof(line), file)) {
+        double values[4];
+        char *p = line;
+        size_t used;
+        int k;
+        /* A line that does not fit would be read as several */
+        if(!strchr(line, '\n') && !feof(file)) {
+            int c = getc(file);
+            if(c != '\n' && c != EOF) {
+                ok = 0;
+                break;
+            }
+        }
+        /* Not strtod(), which would expect decimal commas in some locales.
+        A field only counts if the number is all of it, so that headings
+        such as "Nanometers" are not read as "nan". */
+        for(k = 0; k < 4; k++) {
+            p += strspn(p, " \t,;");
+            if(cars_parse(p, strlen(p), values + k, &used) != CARS_OK ||
+                (p[used] != '\0' && !strchr(" \t,;\r\n", p[used])))
+                break;
+            p += used;
+        }
+        if(k == 0)
+            continue;
+        if(k < 4 || values[1] != floor(values[1])) {
+            ok = 0;
+            break;
+        }
+        if(n == allocated) {
+            allocated = allocated? 2 * allocated : 64;
+            double *more_columns = realloc(columns,
+                3 * allocated * sizeof(double));
+            int *more_channels = realloc(channels, allocated * sizeof(int));
+            if(more_columns)
+                columns = more_columns;
+            if(more_channels)
+                channels = more_channels;
+            if(!more_columns || !more_channels) {
+                ok = 0;
+                break;
+            }
+        }
+        columns[3 * n] = values[0] / 1e9;
+        channels[n] = (int)values[1];
+        columns[3 * n + 1] = values[2];
+        columns[3 * n + 2] = values[3] / 1e3;
+        n++;
+    }
+    fclose(file);
+
+    CarsTuningTable *table = NULL;
+    if(ok && n > 0) {
+        /* Transpose into the constructor's columns */
+        double *transposed = malloc(3 * n * sizeof(double));
+        size_t i;
+        if(transposed) {
+            for(i = 0; i < n; i++) {
+                transposed[i] = columns[3 * i];
+                transposed[n + i] = columns[3 * i + 1];
+                transposed[2 * n + i] = columns[3 * i + 2];
+            }
+            table = cars_tuning_table_new(transposed, channels,
+                transposed + n, transposed + 2 * n, n);
+        }
+        free(transposed);
+    }
+    free(columns);
+    free(channels);
+    return table;
+}
+
+/* Index of the last row in [first, first + count) whose value is not past x
+in the given direction, but at most the second to last */
+static size_t
+find_interval(const double *values, size_t first, size_t count, double x,
+    int direction)
+{
+    size_t lo = first, hi = first + count - 1;
+    while(hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(direction > 0? values[mid] <= x : values[mid] >= x)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+CarsStatus
+cars_tuning_lookup(const CarsTuningTable *table, const double *signal,
+    int *channel, double *temperature, double *cavity, size_t n)
+{
+    size_t i, c;
+    for(i = 0; i < n; i++) {
+        double s = signal[i], margin = -INFINITY;
+        size_t best = 0;
+
+        /* Where channels overlap, use the one that is furthest from the end
+        of its range */
+        for(c = 0; c < table->num_channels; c++) {
+            const double *column = table->signal + table->first[c];
+            double m = fmin(s - column[0], column[table->count[c] - 1] - s);
+            if(m > margin) {
+                margin = m;
+                best = c;
+            }
+        }
+        if(!(margin >= 0.0)) {
+            channel[i] = -1;
+            temperature[i] = NAN;
+            cavity[i] = NAN;
+            continue;
+        }
+
+        channel[i] = table->channel[best];
+        if(table->count[best] == 1) {
+            temperature[i] = table->temperature[table->first[best]];
+            cavity[i] = table->cavity[table->first[best]];
+            continue;
+        }
+        size_t j = find_interval(table->signal, table->first[best],
+            table->count[best], s, 1);
+        double t = (s - table->signal[j]) /
+            (table->signal[j + 1] - table->signal[j]);
+        temperature[i] = table->temperature[j] +
+            t * (table->temperature[j + 1] - table->temperature[j]);
+        cavity[i] = table->cavity[j] +
+            t * (table->cavity[j + 1] - table->cavity[j]);
+    }
+    return CARS_OK;
+}
+
+CarsStatus
+cars_tuning_inverse(const CarsTuningTable *table, const int *channel,
+    const double *temperature, double *signal, size_t n)
+{
+    size_t i, c;
+    for(i = 0; i < n; i++) {
+        signal[i] = NAN;
+        for(c = 0; c < table->num_channels; c++)
+            if(table->channel[c] == channel[i])
+                break;
+        if(c == table->num_channels || table->direction[c] == 0)
+            continue;
+
+        const double *column = table->temperature + table->first[c];
+        double x = temperature[i], low = column[0],
+            high = column[table->count[c] - 1];
+        if(!(x >= fmin(low, high) && x <= fmax(low, high)))
+            continue;
+        size_t j = find_interval(table->temperature, table->first[c],
+            table->count[c], x, table->direction[c]);
+        double t = (x - table->temperature[j]) /
+            (table->temperature[j + 1] - table->temperature[j]);
+        signal[i] = table->signal[j] +
+            t * (table->signal[j + 1] - table->signal[j]);
+    }
+    return CARS_OK;
+}